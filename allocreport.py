@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2024 Christian Walther
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the “Software”), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+# Summarize a dump written by _pew.alloc_dump(path) on the Playdate (copy it
+# from the data folder) or captured from its serial output: the allocation
+# sites with the most bytes allocated, and the fragmentation of each heap area.
+# Usage: allocreport.py dumpfile [number of sites to show]
+
+import sys
+
+def main():
+	top = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+	sites = []
+	areas = []
+	with open(sys.argv[1]) as f:
+		for line in f:
+			line = line.rstrip('\n')
+			if line.startswith('site '):
+				_, count, nbytes, where, block = line.split(' ', 4)
+				sites.append((int(nbytes), int(count), where, block))
+			elif line.startswith('area '):
+				_, index, blocks, blocksize = line.split()
+				areas.append([int(index), int(blocks), int(blocksize), ''])
+			elif areas and line and set(line) <= set('.h=m'):
+				areas[-1][3] += line
+
+	if sites:
+		total_bytes = sum(s[0] for s in sites)
+		total_count = sum(s[1] for s in sites)
+		print('%d allocations, %d bytes, top sites by bytes:' % (total_count, total_bytes))
+		print('%10s %8s %6s  %s' % ('bytes', 'count', '%', 'site'))
+		for nbytes, count, where, block in sorted(sites, reverse=True)[:top]:
+			print('%10d %8d %6.1f  %s %s' % (nbytes, count, 100.0 * nbytes / total_bytes, where, block))
+		print()
+
+	for index, blocks, blocksize, cells in areas:
+		free = cells.count('.')
+		runs = [len(r) for r in cells.replace('h', ' ').replace('=', ' ').replace('m', ' ').split()]
+		largest = max(runs) if runs else 0
+		heads = cells.count('h')
+		print('area %d: %d blocks of %d bytes, %d allocations, %d blocks free in %d runs, largest free run %d blocks (%d bytes), fragmentation %.0f%%' % (
+			index, blocks, blocksize, heads, free, len(runs), largest, largest * blocksize,
+			100.0 * (1 - largest / free) if free else 0.0))
+
+main()
@@ -0,0 +1,44 @@
+# Copyright (c) 2026 Christian Walther
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the “Software”), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+# Measure the cost of the VM hook that runs at every backward branch, to compare
+# the default build (counting down a divisor) with one built with
+# -DPEW_CYCLE_COUNTER=1 (comparing against the cycle counter). Put this into
+# _Data/ch.kolleegium.pewpew/Files/ and run `import hookbench` in the REPL,
+# once with each build. The loops are short enough that no call spans the end
+# of a frame, so the minimum time is unaffected by yielding to the system.
+
+import _pew
+
+N = 1000
+
+def for_loop():
+	for i in range(N):
+		pass
+
+def while_loop():
+	i = 0
+	while i < N:
+		i += 1
+
+hz = _pew.cpu_hz()
+for name, fn in (('for', for_loop), ('while', while_loop)):
+	t = _pew.bench(fn, 100)[0]
+	print('%s: %d ns per iteration' % (name, t * 1000000000 // hz // N))
@@ -27,6 +27,9 @@ EMBED_EXTRA += \
 # Include library sources for littlefs 2 in the output.
 EMBED_EXTRA += littlefs2
 
+# Include library sources for the deflate module in the output.
+EMBED_EXTRA += lib/uzlib
+
 # Freeze Python modules.
 FROZEN_MANIFEST ?= manifest.py
 
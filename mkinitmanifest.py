@@ -0,0 +1,39 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2024 Christian Walther
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the “Software”), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+# Write the manifest of the files given as arguments that _pew.sync_initfiles()
+# compares against the data folder at startup, one line per file:
+# "<size> <32-bit FNV-1a hash in hex> <name>"
+
+import os
+import sys
+
+def fnv1a(data):
+	h = 2166136261
+	for b in data:
+		h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+	return h
+
+for path in sys.argv[1:]:
+	with open(path, 'rb') as f:
+		data = f.read()
+	sys.stdout.write('%d %08x %s\n' % (len(data), fnv1a(data), os.path.basename(path)))
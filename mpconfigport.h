@@ -24,6 +24,16 @@
 #define MICROPY_VFS_LFS2                        (1)
 #define MICROPY_READER_VFS                      (1)
 #define MICROPY_PY_VFS                          (1)
+// Read-only filesystem for the bundled files, see romfs.c.
+#define MICROPY_VFS_ROM                         (1)
+
+// Loading of .mpy files, also needed to import compressed .mpy.z files from
+// VfsPD, which decompresses them using the deflate module. Requires additions
+// to EMBED_EXTRA, see micropython_embed.mk.
+#define MICROPY_PERSISTENT_CODE_LOAD            (1)
+#define MICROPY_PY_DEFLATE                      (1)
+// Saving of .mpy files, for the bytecode cache in vfs_pd_mpycache.c.
+#define MICROPY_PERSISTENT_CODE_SAVE            (1)
 
 // Enable floating point numbers and the math module.
 #define MICROPY_FLOAT_IMPL                      (MICROPY_FLOAT_IMPL_FLOAT)
@@ -58,6 +68,41 @@
 
 #define MP_STATE_PORT MP_STATE_VM
 
+// The heap starts with one region and grows by adding more as needed, up to a
+// limit from the preferences, see pd_hal_heap_init().
+#define MICROPY_GC_SPLIT_HEAP                   (1)
+#define MICROPY_GC_SPLIT_HEAP_AUTO              (1)
+void *pd_hal_alloc_heap(size_t size);
+void pd_hal_free_heap(void *ptr);
+#define MP_PLAT_ALLOC_HEAP(size) pd_hal_alloc_heap(size)
+#define MP_PLAT_FREE_HEAP(ptr) pd_hal_free_heap(ptr)
+
+// Native code emitters for @micropython.native and @micropython.viper: Thumb on
+// the device, plus @micropython.asm_thumb, and x64 on the simulator where
+// available. The micropython_embed build, which has neither TARGET_ defined,
+// gets all of them so that it generates all required qstrs. Native code does
+// not run the VM hooks, so it has to call _pew.poll() in loops to yield, which
+// native_check.c enforces on the device.
+#if defined(TARGET_PLAYDATE) || !defined(TARGET_SIMULATOR)
+#define MICROPY_EMIT_THUMB                      (1)
+#define MICROPY_EMIT_INLINE_THUMB               (1)
+#endif
+#if !defined(TARGET_PLAYDATE) && (!defined(TARGET_SIMULATOR) || (defined(__x86_64__) && !defined(_WIN32)))
+#define MICROPY_EMIT_X64                        (1)
+#endif
+#if defined(TARGET_PLAYDATE)
+// Native code lives in the GC heap, which is executable, but the instruction
+// cache needs to be told about it.
+void *pd_hal_commit_exec(void *buf, size_t len, void *reloc);
+#define MP_PLAT_COMMIT_EXEC(buf, len, reloc) pd_hal_commit_exec(buf, len, reloc)
+#elif defined(TARGET_SIMULATOR) && MICROPY_EMIT_X64
+// Memory from malloc() is not executable on desktop operating systems.
+void pd_hal_alloc_exec(size_t min_size, void **ptr, size_t *size);
+void pd_hal_free_exec(void *ptr, size_t size);
+#define MP_PLAT_ALLOC_EXEC(min_size, ptr, size) pd_hal_alloc_exec(min_size, ptr, size)
+#define MP_PLAT_FREE_EXEC(ptr, size) pd_hal_free_exec(ptr, size)
+#endif
+
 void pd_hal_wfe_indefinite(void);
 void pd_hal_wfe_ms(int timeout_ms);
 #define MICROPY_INTERNAL_WFE(TIMEOUT_MS) do { \
@@ -68,11 +113,52 @@ void pd_hal_wfe_ms(int timeout_ms);
 		pd_hal_wfe_ms(TIMEOUT_MS); \
 	} \
 } while (0)
+// without a deadline, check the time at every this many branches
 #define MICROPY_VM_HOOK_COUNT (10)
+// Use the Cortex-M7 cycle counter on the device for the clock and the VM hook.
+// Off by default until it has been verified on hardware that the game may
+// access the debug registers, and measured with hookbench.py that the hook is
+// no slower than the divisor.
+#ifndef PEW_CYCLE_COUNTER
+#define PEW_CYCLE_COUNTER (0)
+#endif
+#if defined(TARGET_PLAYDATE) && PEW_CYCLE_COUNTER
+// Yield to the Playdate system when the end of the current update() is
+// reached, checked against the Cortex-M7 cycle counter (DWT_CYCCNT) at every
+// branch, which should be as cheap as counting down a divisor and saves
+// calling through the SDK to read the time. See pd_hal_set_yield_deadline().
+extern uint32_t pd_hal_yield_cycles;
+void pd_hal_vm_yield(void);
+#define MICROPY_VM_HOOK_POLL if ((int32_t)(*(volatile uint32_t*)0xE0001004 - pd_hal_yield_cycles) >= 0) { \
+	pd_hal_vm_yield(); \
+}
+#else
 #define MICROPY_VM_HOOK_INIT static uint vm_hook_divisor = MICROPY_VM_HOOK_COUNT;
 #define MICROPY_VM_HOOK_POLL if (--vm_hook_divisor == 0) { \
 	vm_hook_divisor = MICROPY_VM_HOOK_COUNT; \
 	pd_hal_wfe_ms(0); \
 }
-#define MICROPY_VM_HOOK_LOOP MICROPY_VM_HOOK_POLL
-#define MICROPY_VM_HOOK_RETURN MICROPY_VM_HOOK_POLL
+#endif
+// The allocation profiler (alloc_profile.c) keeps track of the source position
+// of the running bytecode and the sampling profiler (sample_profile.c) samples
+// it, code_state and ip are locals of mp_execute_bytecode().
+extern int pew_alloc_profile_enabled;
+void pew_alloc_profile_site(void *code_state, const unsigned char *ip);
+extern int pew_sample_profile_enabled;
+void pew_sample_profile_tick(void *code_state, const unsigned char *ip);
+#define MICROPY_VM_HOOK_LOOP \
+	if (pew_alloc_profile_enabled) { \
+		pew_alloc_profile_site(code_state, ip); \
+	} \
+	if (pew_sample_profile_enabled) { \
+		pew_sample_profile_tick(code_state, ip); \
+	} \
+	MICROPY_VM_HOOK_POLL
+#define MICROPY_VM_HOOK_RETURN \
+	if (pew_alloc_profile_enabled) { \
+		pew_alloc_profile_site(NULL, NULL); \
+	} \
+	if (pew_sample_profile_enabled) { \
+		pew_sample_profile_tick(code_state, ip); \
+	} \
+	MICROPY_VM_HOOK_POLL
@@ -2,8 +2,39 @@
 
 #include "py/ringbuf.h"
 
-// There is probably some STM32 register that we could read out, but for now
-// let's stay portable and use the Playdate API.
-#define mp_hal_ticks_cpu mp_hal_ticks_us
+// High-resolution clock, see mphal.c. pd_hal_clock_init() must be called
+// before the others. CPU ticks are cycles on the device and nanoseconds on the
+// simulator, pd_hal_cpu_hz() says which.
+void pd_hal_clock_init(void);
+uint64_t pd_hal_ticks_us64(void);
+uint32_t pd_hal_ticks_cpu(void);
+uint32_t pd_hal_cpu_hz(void);
+// pd_hal_ticks_us64() at pd_hal_clock_init(), so that times as floats start
+// near 0 and keep their precision.
+extern uint64_t pd_hal_clock_start_us;
+// Set when MICROPY_VM_HOOK_POLL yields on the device, ms from now.
+void pd_hal_set_yield_deadline(unsigned int ms);
+#define mp_hal_ticks_cpu pd_hal_ticks_cpu
 
 extern ringbuf_t stdin_ringbuf;
+
+// The Python heap, see mphal.c.
+void pd_hal_heap_init(size_t size, size_t limit);
+void pd_hal_heap_info(size_t *regions, size_t *total, size_t *limit);
+
+// Garbage collection statistics, see mphal.c. Pause times of collections not
+// started by pd_hal_idle_gc() are only known on the device.
+#define PD_HAL_GC_HIST_BUCKETS 7
+typedef struct {
+	// collections run by pd_hal_idle_gc() and others (allocation failure,
+	// gc.collect())
+	uint32_t idle;
+	uint32_t other;
+	uint32_t max_us;
+	// total time spent collecting
+	uint32_t total_us;
+	// pause times: < 1 ms, < 2 ms, < 4 ms, ..., >= 32 ms
+	uint32_t hist[PD_HAL_GC_HIST_BUCKETS];
+} pd_hal_gc_stats_t;
+extern pd_hal_gc_stats_t pd_hal_gc_stats;
+void pd_hal_idle_gc(void);
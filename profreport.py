@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2024 Christian Walther
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the “Software”), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+# Summarize dumps written by _pew.sample_dump(path) on the Playdate (copy them
+# from the data folder) or captured from its serial output: the source lines
+# and functions with the most samples, or with --folded, folded stacks
+# ("file:function;line count" per line) as input for flamegraph.pl or
+# speedscope. Several dumps of the same game are added up.
+# Usage: profreport.py [--folded] dumpfile... [> out.folded]
+
+import sys
+
+def main():
+	args = sys.argv[1:]
+	folded = '--folded' in args
+	files = [a for a in args if a != '--folded']
+	if not files:
+		sys.exit('usage: profreport.py [--folded] dumpfile...')
+	lines = {}
+	interval = 0
+	total = 0
+	for name in files:
+		with open(name) as f:
+			for line in f:
+				line = line.rstrip('\n')
+				if line.startswith('sample '):
+					_, count, where, block = line.split(' ', 3)
+					lines[(where, block)] = lines.get((where, block), 0) + int(count)
+				elif line.startswith('interval '):
+					interval = int(line.split()[1])
+				elif line.startswith('total '):
+					total += int(line.split()[1])
+
+	if folded:
+		for (where, block), count in sorted(lines.items()):
+			file, _, lineno = where.rpartition(':')
+			print('%s:%s;%s %d' % (file, block, lineno, count))
+		return
+
+	kept = sum(lines.values())
+	if kept == 0:
+		print('no samples')
+		return
+	print('%d samples every %d us (%d taken, the rest overwritten)' % (kept, interval, total))
+	functions = {}
+	for (where, block), count in lines.items():
+		key = (where.rpartition(':')[0], block)
+		functions[key] = functions.get(key, 0) + count
+	print('%8s %6s  %s' % ('samples', '%', 'function'))
+	for (file, block), count in sorted(functions.items(), key=lambda i: -i[1])[:20]:
+		print('%8d %6.1f  %s %s' % (count, 100.0 * count / kept, file, block))
+	print()
+	print('%8s %6s  %s' % ('samples', '%', 'line'))
+	for (where, block), count in sorted(lines.items(), key=lambda i: -i[1])[:20]:
+		print('%8d %6.1f  %s %s' % (count, 100.0 * count / kept, where, block))
+
+main()
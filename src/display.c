@@ -24,11 +24,15 @@ THE SOFTWARE.
 #include "globals.h"
 #include "preferences.h"
 #include "terminal.h"
+#include "framestats.h"
+#include "input.h"
 
 #include "py/mphal.h"
 #include "py/binary.h"
+#include "py/gc.h"
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 #define WIDTH 8
@@ -38,6 +42,13 @@ THE SOFTWARE.
 #define MX (200 - (WIDTH/2)*TILEW)
 #define MY (120 - (HEIGHT/2)*TILEH)
 
+// frame statistics overlay in the top left corner, left of the pixels
+#define STATSW (MX - 2)
+#define STATSLINEH 15
+#define STATSLINES 5
+// redraw it every this many frames
+#define STATSINTERVAL 15
+
 enum {
 	eDirtyBackground = 1 << 0
 };
@@ -64,6 +75,9 @@ static uint8_t backbuf[eBufferSize];
 static uint8_t dirty;
 static PDButtons currentKeys;
 static PDButtons collectedKeys;
+static int statsOverlay;
+static int statsCountdown;
+static LCDFont* statsFont;
 
 void displaySetInverted(PlaydateAPI* pd, int inv) {
 	const char* err;
@@ -90,15 +104,53 @@ void displayInit(PlaydateAPI* pd) {
 	}
 	displaySetInverted(pd, preferences.inverted);
 	memset(frontbuf, 255, eBufferSize);
+	statsFont = pd->graphics->loadFont("fonts/ttyp0-15", &err);
+	if (statsFont == NULL) {
+		pd->system->error("Couldn't load font: %s", err);
+	}
+	statsOverlay = preferences.stats;
+}
+
+void displaySetStatsOverlay(int on) {
+	statsOverlay = on;
+	statsCountdown = 0;
+	// erase it or draw it right away
+	dirty |= eDirtyBackground;
+}
+
+static void displayDrawStats(PlaydateAPI* pd) {
+	FrameStatSummary frame, python, idle;
+	frameStatsSummarize(eFrameStatFrame, &frame);
+	frameStatsSummarize(eFrameStatPython, &python);
+	frameStatsSummarize(eFrameStatIdle, &idle);
+	gc_info_t info;
+	gc_info(&info);
+	int fps10 = (frame.avg > 0) ? (int)(10000000 / frame.avg) : 0;
+	char lines[STATSLINES][12];
+	snprintf(lines[0], sizeof(lines[0]), "%d.%d fps", fps10 / 10, fps10 % 10);
+	snprintf(lines[1], sizeof(lines[1]), "py %d.%dms", (int)(python.avg / 1000), (int)(python.avg / 100 % 10));
+	snprintf(lines[2], sizeof(lines[2]), "idle %dms", (int)(idle.avg / 1000));
+	snprintf(lines[3], sizeof(lines[3]), "free %dk", (int)(info.free / 1024));
+	snprintf(lines[4], sizeof(lines[4]), "stk %dk", pythonStackHighWater() / 1024);
+	pd->graphics->fillRect(0, 0, STATSW, STATSLINES * STATSLINEH + 4, kColorWhite);
+	pd->graphics->setFont(statsFont);
+	for (int i = 0; i < STATSLINES; i++) {
+		pd->graphics->drawText(lines[i], strlen(lines[i]), kASCIIEncoding, 2, 2 + i * STATSLINEH);
+	}
 }
 
 void displayTouch(void) {
 	dirty |= eDirtyBackground;
 }
 
-void displayUpdate(PlaydateAPI* pd) {
+int displayUpdate(PlaydateAPI* pd) {
+	int drew = 0;
 	PDButtons pushed;
 	pd->system->getButtonState(&currentKeys, &pushed, NULL);
+	inputCollect(pd);
+	if (pushed & (kButtonLeft|kButtonRight|kButtonUp|kButtonDown|kButtonB|kButtonA)) {
+		frameStatsProbePress(inputLastPress());
+	}
 	// when the restart indicator is on, A sends ^D
 	if (pythonInRepl && pythonWaitingForInput && (pushed & kButtonA)) {
 		ringbuf_put(&stdin_ringbuf, 0x04);
@@ -109,6 +161,14 @@ void displayUpdate(PlaydateAPI* pd) {
 		pd->graphics->drawBitmap(background, 0, 0, kBitmapUnflipped);
 		memset(frontbuf, 255, eBufferSize);
 		dirty &= ~eDirtyBackground;
+		statsCountdown = 0;
+		drew = 1;
+	}
+
+	if (statsOverlay && --statsCountdown <= 0) {
+		displayDrawStats(pd);
+		statsCountdown = STATSINTERVAL;
+		drew = 1;
 	}
 
 	backbuf[eIndicatorMenu] = terminalUnread;
@@ -116,6 +176,7 @@ void displayUpdate(PlaydateAPI* pd) {
 
 	uint8_t* frontpix = &frontbuf[0];
 	uint8_t* backpix = &backbuf[0];
+	int drewPixels = 0;
 	for (int y = 0; y < HEIGHT; y++) {
 		for (int x = 0; x < WIDTH; x++) {
 			uint8_t c = *backpix;
@@ -123,21 +184,26 @@ void displayUpdate(PlaydateAPI* pd) {
 				*frontpix = c;
 				LCDBitmap* bmp = pd->graphics->getTableBitmap(pixeltable, c);
 				pd->graphics->drawBitmap(bmp, MX + TILEW * x, MY + TILEH * y, kBitmapUnflipped);
+				drewPixels = 1;
 			}
 			frontpix++;
 			backpix++;
 		}
 	}
+	frameStatsProbeDrawn(drewPixels, pd->system->getCurrentTimeMilliseconds());
+	drew |= drewPixels;
 	for (struct Indicator* i = &indicators[0]; i->tableName != NULL; i++) {
 		uint8_t c = *backpix;
 		if (*frontpix != c) {
 			*frontpix = c;
 			LCDBitmap* bmp = pd->graphics->getTableBitmap(i->table, c);
 			pd->graphics->drawBitmap(bmp, i->x, i->y, kBitmapUnflipped);
+			drew = 1;
 		}
 		frontpix++;
 		backpix++;
 	}
+	return drew;
 }
 
 mp_obj_t displayShow(mp_obj_t bufferobj, mp_obj_t width) {
@@ -170,6 +236,7 @@ mp_obj_t displayShow(mp_obj_t bufferobj, mp_obj_t width) {
 			}
 		}
 	}
+	frameStatsProbeShow();
 	return mp_const_none;
 }
 
@@ -27,7 +27,9 @@ THE SOFTWARE.
 
 void displayInit(PlaydateAPI* pd);
 void displayTouch(void);
-void displayUpdate(PlaydateAPI* pd);
+// Returns whether anything was drawn.
+int displayUpdate(PlaydateAPI* pd);
 void displaySetInverted(PlaydateAPI* pd, int inv);
+void displaySetStatsOverlay(int on);
 mp_obj_t displayShow(mp_obj_t bufferobj, mp_obj_t width);
 mp_obj_t displayKeys(void);
@@ -0,0 +1,145 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "framestats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "py/mphal.h"
+
+uint32_t frameStatsWaitUs;
+
+static uint32_t history[eFrameStatCount][FRAMESTATS_FRAMES];
+// slot for the current frame, completed by the next frameStatsBegin() when
+// its frame time is known
+static int next = 0;
+static int count = 0;
+static int pending = 0;
+static uint32_t frameStartUs;
+static uint32_t gcStartUs;
+
+uint32_t frameStatsBegin(void) {
+	uint32_t now = mp_hal_ticks_us();
+	if (pending) {
+		uint32_t frame = now - frameStartUs;
+		uint32_t work = history[eFrameStatCard][next] + history[eFrameStatPython][next] - history[eFrameStatWait][next];
+		history[eFrameStatFrame][next] = frame;
+		history[eFrameStatIdle][next] = (frame > work) ? frame - work : 0;
+		next = (next + 1) % FRAMESTATS_FRAMES;
+		if (count < FRAMESTATS_FRAMES) {
+			count++;
+		}
+	}
+	frameStartUs = now;
+	frameStatsWaitUs = 0;
+	gcStartUs = pd_hal_gc_stats.total_us;
+	return now;
+}
+
+void frameStatsEnd(uint32_t cardUs, uint32_t pythonUs) {
+	history[eFrameStatCard][next] = cardUs;
+	history[eFrameStatPython][next] = pythonUs;
+	history[eFrameStatWait][next] = frameStatsWaitUs;
+	history[eFrameStatGC][next] = pd_hal_gc_stats.total_us - gcStartUs;
+	pending = 1;
+}
+
+FrameStatsLatency frameStatsLatency;
+
+static enum {
+	eProbeIdle,
+	// a button was pressed
+	eProbeArmed,
+	// and then Python showed something
+	eProbeShown
+} probeState = eProbeIdle;
+static uint32_t probePressMs;
+
+void frameStatsProbePress(uint32_t ms) {
+	if (probeState == eProbeIdle) {
+		probeState = eProbeArmed;
+		probePressMs = ms;
+	}
+}
+
+void frameStatsProbeShow(void) {
+	if (probeState == eProbeArmed) {
+		probeState = eProbeShown;
+	}
+}
+
+void frameStatsProbeDrawn(int drew, uint32_t ms) {
+	uint32_t latency = ms - probePressMs;
+	if (probeState == eProbeShown) {
+		// if the show didn't change anything, this press is not measurable
+		if (drew) {
+			frameStatsLatency.count++;
+			frameStatsLatency.totalMs += latency;
+			if (latency > frameStatsLatency.maxMs) {
+				frameStatsLatency.maxMs = latency;
+			}
+			int bucket = 0;
+			for (uint32_t l = latency / 8; l > 0 && bucket < FRAMESTATS_LATENCY_BUCKETS - 1; l >>= 1) {
+				bucket++;
+			}
+			frameStatsLatency.hist[bucket]++;
+		}
+		probeState = eProbeIdle;
+	}
+	else if (probeState == eProbeArmed && latency > FRAMESTATS_PROBE_TIMEOUT_MS) {
+		probeState = eProbeIdle;
+	}
+}
+
+void frameStatsProbeReset(void) {
+	probeState = eProbeIdle;
+}
+
+int frameStatsCount(void) {
+	return count;
+}
+
+static int compareUint32(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+void frameStatsSummarize(FrameStat stat, FrameStatSummary* summary) {
+	memset(summary, 0, sizeof(*summary));
+	if (count == 0) {
+		return;
+	}
+	uint32_t sorted[FRAMESTATS_FRAMES];
+	int first = (next - count + FRAMESTATS_FRAMES) % FRAMESTATS_FRAMES;
+	uint64_t sum = 0;
+	for (int i = 0; i < count; i++) {
+		sorted[i] = history[stat][(first + i) % FRAMESTATS_FRAMES];
+		sum += sorted[i];
+	}
+	qsort(sorted, count, sizeof(sorted[0]), compareUint32);
+	summary->avg = sum / count;
+	summary->p50 = sorted[count / 2];
+	summary->p95 = sorted[(count * 95) / 100];
+	summary->max = sorted[count - 1];
+}
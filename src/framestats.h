@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Per-frame timings in microseconds, the last FRAMESTATS_FRAMES frames of each
+// are kept.
+#define FRAMESTATS_FRAMES 64
+
+typedef enum {
+	// from the start of one update() to the next
+	eFrameStatFrame,
+	// displayUpdate() or terminalUpdate()
+	eFrameStatCard,
+	// the Python coroutine's slice, including the following two
+	eFrameStatPython,
+	// busy-waiting in pd_hal_wfe_ms()
+	eFrameStatWait,
+	// garbage collection
+	eFrameStatGC,
+	// frame time not spent on the card or Python work
+	eFrameStatIdle,
+	eFrameStatCount
+} FrameStat;
+
+typedef struct {
+	uint32_t avg;
+	uint32_t p50;
+	uint32_t p95;
+	uint32_t max;
+} FrameStatSummary;
+
+// accumulated during the frame by pd_hal_wfe_ms()
+extern uint32_t frameStatsWaitUs;
+
+// Called at the start of update(), returns the time in microseconds.
+uint32_t frameStatsBegin(void);
+// Called at the end of update() with the times taken by the card and Python.
+void frameStatsEnd(uint32_t cardUs, uint32_t pythonUs);
+// Number of frames recorded, at most FRAMESTATS_FRAMES.
+int frameStatsCount(void);
+void frameStatsSummarize(FrameStat stat, FrameStatSummary* summary);
+
+// Input-to-photon latency probe: from a button press (as timestamped by the
+// SDK) through the next displayShow() to the frame in which displayUpdate()
+// draws the changed pixels, which the system sends to the display right after
+// update() returns. One press is followed at a time, presses that don't lead
+// to a change on screen within FRAMESTATS_PROBE_TIMEOUT_MS are dropped.
+#define FRAMESTATS_PROBE_TIMEOUT_MS 1000
+// < 8 ms, < 16 ms, < 32 ms, ..., >= 256 ms
+#define FRAMESTATS_LATENCY_BUCKETS 7
+
+typedef struct {
+	uint32_t count;
+	uint32_t totalMs;
+	uint32_t maxMs;
+	uint32_t hist[FRAMESTATS_LATENCY_BUCKETS];
+} FrameStatsLatency;
+
+extern FrameStatsLatency frameStatsLatency;
+
+void frameStatsProbePress(uint32_t ms);
+void frameStatsProbeShow(void);
+// Called at the end of displayUpdate() with whether any pixels were drawn.
+void frameStatsProbeDrawn(int drew, uint32_t ms);
+// Drops the press being followed, when what is drawn no longer depends on it.
+void frameStatsProbeReset(void);
@@ -28,3 +28,15 @@ extern PlaydateAPI* global_pd;
 extern unsigned int updateEndDue;
 extern int pythonInRepl;
 extern int pythonWaitingForInput;
+
+// Size of the stack of the Python coroutine in bytes, and the largest part of
+// it used so far (found by looking for the paint applied at startup).
+extern int pythonStackSize;
+int pythonStackHighWater(void);
+
+// Display refresh rate in frames per second, clamped to what the display
+// supports. The time given to Python in each update() follows it. While
+// frameRateAuto is set, _pew.tick() adjusts it to the game's tick rate.
+extern float frameRate;
+extern int frameRateAuto;
+void frameRateSet(float fps);
@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "input.h"
+
+static InputEvent queue[INPUT_EVENTS];
+static unsigned int queueGet = 0;
+static unsigned int queuePut = 0;
+static uint32_t dropped = 0;
+static uint32_t lastPress = 0;
+// nothing is queued until someone reads the queue
+static int enabled = 0;
+
+static InputEvent* inputPush(void) {
+	if (!enabled) {
+		return NULL;
+	}
+	if (queuePut - queueGet >= INPUT_EVENTS) {
+		// the recent events are the ones that matter
+		queueGet++;
+		dropped++;
+	}
+	return &queue[queuePut++ % INPUT_EVENTS];
+}
+
+static int onButton(PDButtons button, int down, uint32_t when, void* userdata) {
+	(void)userdata;
+	// the menu button is handled by the system
+	if (button & (kButtonLeft|kButtonRight|kButtonUp|kButtonDown|kButtonB|kButtonA)) {
+		if (down) {
+			lastPress = when;
+		}
+		InputEvent* e = inputPush();
+		if (e != NULL) {
+			e->ms = when;
+			e->kind = down ? eInputPress : eInputRelease;
+			e->button = button;
+			e->crank = 0.0f;
+		}
+	}
+	return 0;
+}
+
+void inputInit(PlaydateAPI* pd) {
+	// the queue must hold a frame's worth of events at the lowest frame rate
+	pd->system->setButtonCallback(&onButton, NULL, INPUT_EVENTS);
+}
+
+void inputCollect(PlaydateAPI* pd) {
+	if (pd->system->isCrankDocked()) {
+		return;
+	}
+	float change = pd->system->getCrankChange();
+	if (change != 0.0f) {
+		InputEvent* e = inputPush();
+		if (e != NULL) {
+			e->ms = pd->system->getCurrentTimeMilliseconds();
+			e->kind = eInputCrank;
+			e->button = 0;
+			e->crank = change;
+		}
+	}
+}
+
+void inputReset(void) {
+	queueGet = queuePut = 0;
+	dropped = 0;
+	enabled = 0;
+}
+
+int inputPop(InputEvent* event) {
+	enabled = 1;
+	if (queueGet == queuePut) {
+		return 0;
+	}
+	*event = queue[queueGet++ % INPUT_EVENTS];
+	return 1;
+}
+
+uint32_t inputLastPress(void) {
+	return lastPress;
+}
+
+uint32_t inputDropped(void) {
+	return dropped;
+}
@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "pd_api.h"
+
+// Queue of timestamped input events for _pew.events(). Button edges come
+// from the SDK's button callback, which reports when they actually happened
+// (so presses and releases within one frame are kept apart), crank movement
+// is collected once per frame by the cards.
+#define INPUT_EVENTS 64
+
+typedef enum {
+	eInputPress = 1,
+	eInputRelease = 2,
+	eInputCrank = 3
+} InputEventKind;
+
+typedef struct {
+	// getCurrentTimeMilliseconds() time of the event
+	uint32_t ms;
+	uint8_t kind;
+	// the button for eInputPress and eInputRelease
+	uint8_t button;
+	// change in degrees for eInputCrank
+	float crank;
+} InputEvent;
+
+void inputInit(PlaydateAPI* pd);
+// Called by displayUpdate() and terminalUpdate().
+void inputCollect(PlaydateAPI* pd);
+// Empty the queue and stop collecting until the next inputPop(), on soft
+// reset.
+void inputReset(void);
+// Take the oldest event out of the queue, returns 0 if there is none. The
+// first call starts collecting events. When the queue is full, the oldest
+// event is dropped.
+int inputPop(InputEvent* event);
+// Time of the most recent button press.
+uint32_t inputLastPress(void);
+// Number of events dropped because the queue was full.
+uint32_t inputDropped(void);
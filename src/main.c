@@ -22,6 +22,7 @@ THE SOFTWARE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "pd_api.h"
 
@@ -44,23 +45,60 @@ THE SOFTWARE.
 #include "terminal.h"
 #include "display.h"
 #include "preferences.h"
-
-#define PYTHON_STACK_SIZE 65536
+#include "romfs.h"
+#include "framestats.h"
+#include "trace.h"
+#include "input.h"
+#include "savestore.h"
+#include "modules/_pew/load_async.h"
+
+// Python stack sizes below this (in bytes) are not accepted from the
+// preferences, the compiler alone needs a good part of it.
+#define PYTHON_STACK_SIZE_MIN 8192
+// Bytes used by pdco (STACKMARGIN) and pythonCoMain() above stack_top.
+#define PYTHON_STACK_OVERHEAD 176
+// Pattern that the unused part of the Python stack is filled with.
+#define PYTHON_STACK_PAINT 0xDEADBEEFu
+// Refresh rates in frames per second: the display does at most 50, below 10
+// input and the terminal become sluggish.
+#define FRAME_RATE_DEFAULT 30.0f
+#define FRAME_RATE_MIN 10.0f
+#define FRAME_RATE_MAX 50.0f
+// While Python waits for input from the terminal and there has been no input
+// for IDLE_AFTER_MS, the refresh rate drops to IDLE_FRAME_RATE.
+#define IDLE_FRAME_RATE 5.0f
+#define IDLE_AFTER_MS 1000
 
 PlaydateAPI* global_pd;
 unsigned int updateEndDue;
 int pythonInRepl;
 int pythonWaitingForInput;
+int pythonStackSize;
+float frameRate;
+int frameRateAuto = 1;
+// milliseconds of each update() until Python must yield
+static unsigned int updateBudget;
+static int idle = 0;
+static unsigned int lastInput;
+static float lastCrankAngle;
+// system menu open or device locked
+static int paused = 0;
+static uint32_t* pythonStackLimit;
+static char* pythonStackTop;
 
 static int update(void* userdata);
 static void onSerialMessage(const char* data);
 static void onMenuInvert(void* userdata);
+static void onMenuStats(void* userdata);
 static void onMenuNavigate(void* userdata);
+static void refreshRateApply(void);
+static void idleUpdate(PlaydateAPI* pd);
 static pdco_handle_t pythonCoMain(pdco_handle_t caller);
 
 typedef struct {
 	void (*enter)(void);
-	void (*update)(PlaydateAPI* pd);
+	// returns whether anything was drawn
+	int (*update)(PlaydateAPI* pd);
 } Card;
 
 static Card displayCard = {
@@ -140,9 +178,6 @@ static const char *example_2 =
 	;
 #endif
 
-// This array is the MicroPython GC heap.
-// TODO enlarge this some time, but while shaking out bugs it seems a good idea to hammer the GC
-static char heap[36 * 1024];
 static pdco_handle_t pythonCo;
 static int pythonExit = 0;
 static Card* currentCard;
@@ -159,24 +194,46 @@ int eventHandler(PlaydateAPI* pd, PDSystemEvent event, uint32_t arg)
 		// Note: If you set an update callback in the kEventInit handler, the system assumes the game is pure C and doesn't run any Lua code in the game
 		pd->system->setUpdateCallback(&update, pd);
 		pd->system->setSerialMessageCallback(&onSerialMessage);
-		pd->display->setRefreshRate(30.0f);
 
 		global_pd = pd;
+		frameRateSet(FRAME_RATE_DEFAULT);
+		pd_hal_clock_init();
 		preferencesRead(pd);
+		romfsLoad(pd);
 		terminalInit(pd);
 		displayInit(pd);
+		inputInit(pd);
 		currentCard = &displayCard;
 
 		PDMenuItem* item = pd->system->addCheckmarkMenuItem("invert", preferences.inverted, &onMenuInvert, NULL);
 		pd->system->setMenuItemUserdata(item, item);
+		item = pd->system->addCheckmarkMenuItem("stats", preferences.stats, &onMenuStats, NULL);
+		pd->system->setMenuItemUserdata(item, item);
 		terminalItem = pd->system->addMenuItem("terminal", &onMenuNavigate, NULL);
 
-		pythonCo = pdco_create(&pythonCoMain, PYTHON_STACK_SIZE, NULL);
+		pythonStackSize = preferences.stacksize * 1024;
+		if (pythonStackSize < PYTHON_STACK_SIZE_MIN) {
+			pythonStackSize = PYTHON_STACK_SIZE_MIN;
+		}
+		pythonCo = pdco_create(&pythonCoMain, pythonStackSize, NULL);
 		if (pythonCo < 0) pd->system->logToConsole("pdco_create error");
 	}
-	else if (event == kEventPause) {
-		pd->system->setMenuItemTitle(terminalItem, (currentCard == &terminalCard) ? "hide terminal" : terminalUnread ? "terminal \xE2\x9C\xA8" : "terminal");
-		pd->system->setMenuItemUserdata(terminalItem, (currentCard == &terminalCard) ? &displayCard : &terminalCard);
+	else if (event == kEventPause || event == kEventLock) {
+		// The system doesn't normally call update() in these states, but make
+		// sure that Python is not resumed until we're back.
+		paused = 1;
+		if (event == kEventLock) {
+			// the device may be about to run out of battery or be reset
+			saveStoreFlushAll(pd);
+		}
+		if (event == kEventPause) {
+			pd->system->setMenuItemTitle(terminalItem, (currentCard == &terminalCard) ? "hide terminal" : terminalUnread ? "terminal \xE2\x9C\xA8" : "terminal");
+			pd->system->setMenuItemUserdata(terminalItem, (currentCard == &terminalCard) ? &displayCard : &terminalCard);
+		}
+	}
+	else if (event == kEventResume || event == kEventUnlock) {
+		paused = 0;
+		lastInput = pd->system->getCurrentTimeMilliseconds();
 	}
 	else if (event == kEventTerminate) {
 		pd->system->logToConsole("telling python to exit");
@@ -193,6 +250,8 @@ int eventHandler(PlaydateAPI* pd, PDSystemEvent event, uint32_t arg)
 			pdco_yield(pythonCo);
 		}
 		pd->system->logToConsole("python exited at %d", pythonExit);
+		// whatever Python saved on the way out is still in memory
+		saveStoreFlushAll(pd);
 	}
 
 	return 0;
@@ -201,19 +260,60 @@ int eventHandler(PlaydateAPI* pd, PDSystemEvent event, uint32_t arg)
 static int update(void* userdata)
 {
 	PlaydateAPI* pd = userdata;
-	// empirical: delays above 31 on the simulator and 33 on the device reduce
-	// the frame rate to less than 30
-	updateEndDue = pd->system->getCurrentTimeMilliseconds() + 32;
-
-	currentCard->update(pd);
-
+	if (paused) {
+		return 0;
+	}
+	idleUpdate(pd);
+	updateEndDue = pd->system->getCurrentTimeMilliseconds() + updateBudget;
+	pd_hal_set_yield_deadline(updateBudget);
+	uint32_t start = frameStatsBegin();
+	TRACE_BEGIN(eTraceUpdate);
+
+	TRACE_BEGIN(eTraceCard);
+	int drew = currentCard->update(pd);
+	TRACE_END(eTraceCard);
+	uint32_t cardEnd = mp_hal_ticks_us();
+
+	// file reads requested by _pew.load_async() happen here, a chunk per frame,
+	// so that Python is not blocked by them
+	TRACE_BEGIN(eTraceLoadAsync);
+	pew_load_async_step();
+	TRACE_END(eTraceLoadAsync);
+
+	uint32_t pythonStart = mp_hal_ticks_us();
+	TRACE_BEGIN(eTracePython);
 	pdco_yield(pythonCo);
+	TRACE_END(eTracePython);
+	frameStatsEnd(cardEnd - start, mp_hal_ticks_us() - pythonStart);
+
+	// at most one pending save file per frame, and only if it has time to spare
+	if ((int)(updateEndDue - pd->system->getCurrentTimeMilliseconds()) > SAVESTORE_MARGIN_MS) {
+		TRACE_BEGIN(eTraceSave);
+		saveStoreFlushOne(pd);
+		TRACE_END(eTraceSave);
+	}
+	TRACE_END(eTraceUpdate);
 
-	return 1;
+	// nothing to send to the display if nothing was drawn
+	return drew;
 }
 
 static void onSerialMessage(const char* data) {
-	if (data[0] == '!') {
+	TRACE_INSTANT(eTraceSerial);
+	lastInput = global_pd->system->getCurrentTimeMilliseconds();
+	if (idle) {
+		idle = 0;
+		refreshRateApply();
+	}
+	if (strcmp(data, "?latency") == 0) {
+		// report on the serial console instead of passing it to Python
+		FrameStatsLatency* l = &frameStatsLatency;
+		global_pd->system->logToConsole("latency: %u presses, avg %u ms, max %u ms, <8/16/32/64/128/256/more ms: %u %u %u %u %u %u %u",
+			(unsigned int)l->count, (unsigned int)(l->count ? l->totalMs / l->count : 0), (unsigned int)l->maxMs,
+			(unsigned int)l->hist[0], (unsigned int)l->hist[1], (unsigned int)l->hist[2], (unsigned int)l->hist[3],
+			(unsigned int)l->hist[4], (unsigned int)l->hist[5], (unsigned int)l->hist[6]);
+	}
+	else if (data[0] == '!') {
 		// base64: can encode any binary data
 		data++;
 		unsigned char acc = 0;
@@ -270,6 +370,13 @@ static void onMenuInvert(void* userdata) {
 	preferencesWrite(global_pd);
 }
 
+static void onMenuStats(void* userdata) {
+	int value = global_pd->system->getMenuItemValue((PDMenuItem *)userdata);
+	displaySetStatsOverlay(value);
+	preferences.stats = value;
+	preferencesWrite(global_pd);
+}
+
 static void onMenuNavigate(void* userdata) {
 	Card* newCard = userdata;
 	if (currentCard != newCard) {
@@ -278,14 +385,77 @@ static void onMenuNavigate(void* userdata) {
 		}
 		currentCard = newCard;
 		currentCard->enter();
+		// the next frame drawn is the other card, not the result of a press
+		frameStatsProbeReset();
 	}
 }
 
+void frameRateSet(float fps) {
+	if (fps < FRAME_RATE_MIN) {
+		fps = FRAME_RATE_MIN;
+	}
+	else if (fps > FRAME_RATE_MAX) {
+		fps = FRAME_RATE_MAX;
+	}
+	if (fps == frameRate) {
+		return;
+	}
+	frameRate = fps;
+	refreshRateApply();
+}
+
+static void refreshRateApply(void) {
+	float fps = idle ? IDLE_FRAME_RATE : frameRate;
+	global_pd->display->setRefreshRate(fps);
+	// empirical: at 30 fps, delays above 31 on the simulator and 33 on the
+	// device reduce the frame rate, so leave a bit more than a millisecond of
+	// the frame period
+	updateBudget = (unsigned int)(1000.0f / fps) - 1;
+}
+
+// Go idle while Python waits for terminal input (the REPL or input()) and
+// nothing happens, and back to full speed as soon as a button, the crank or
+// serial input is used.
+static void idleUpdate(PlaydateAPI* pd) {
+	PDButtons current, pushed;
+	pd->system->getButtonState(&current, &pushed, NULL);
+	float crankAngle = pd->system->getCrankAngle();
+	unsigned int now = pd->system->getCurrentTimeMilliseconds();
+	if (current || pushed || crankAngle != lastCrankAngle) {
+		lastInput = now;
+	}
+	lastCrankAngle = crankAngle;
+	int nowIdle = pythonWaitingForInput && (int)(now - lastInput) >= IDLE_AFTER_MS;
+	if (nowIdle != idle) {
+		idle = nowIdle;
+		refreshRateApply();
+	}
+}
+
+int pythonStackHighWater(void) {
+	if (pythonStackLimit == NULL) {
+		return 0;
+	}
+	const uint32_t* p = pythonStackLimit;
+	while ((const char*)p < pythonStackTop && *p == PYTHON_STACK_PAINT) {
+		p++;
+	}
+	return pythonStackTop - (const char*)p + PYTHON_STACK_OVERHEAD;
+}
+
 static pdco_handle_t pythonCoMain(pdco_handle_t caller) {
 	int stack_top;
-	// deduction accounts for pdco STACKMARGIN and stuff above &stack_top
-	mp_cstack_init_with_top(&stack_top, PYTHON_STACK_SIZE - 176);
-	gc_init(&heap[0], &heap[0] + sizeof(heap));
+	pythonStackTop = (char*)&stack_top;
+	mp_cstack_init_with_top(&stack_top, pythonStackSize - PYTHON_STACK_OVERHEAD);
+	// Paint everything below the current frame (leaving some room for the
+	// loop itself) so that pythonStackHighWater() can see how deep it went.
+	pythonStackLimit = (uint32_t*)(((uintptr_t)&stack_top - (pythonStackSize - PYTHON_STACK_OVERHEAD) + 3) & ~(uintptr_t)3);
+	for (volatile uint32_t* p = pythonStackLimit; (char*)p < pythonStackTop - 256; p++) {
+		*p = PYTHON_STACK_PAINT;
+	}
+	// sizes from data.json, the heap grows on demand from the initial size up
+	// to the limit
+	pd_hal_heap_init((size_t)preferences.heapsize * 1024, (size_t)preferences.heaplimit * 1024);
 
 	while (!pythonExit) {
 		mp_init();
@@ -328,6 +498,10 @@ static pdco_handle_t pythonCoMain(pdco_handle_t caller) {
 	soft_reset_exit:
 		// TODO this shouldn't set terminalUnread when invoked from the A button
 		mp_printf(MP_PYTHON_PRINTER, "MPY: soft reboot\n");
+		pew_load_async_deinit();
+		inputReset();
+		frameRateAuto = 1;
+		frameRateSet(FRAME_RATE_DEFAULT);
 		gc_sweep_all();
 		mp_deinit();
 	}
@@ -1,5 +1,5 @@
-from _pew import VfsPD
-import os, vfs
+from _pew import VfsPD, sync_initfiles
+import os, sys, vfs
 
 def init():
 	vfs.mount(VfsPD(), '/root')
@@ -19,25 +19,25 @@ def init():
 		)
 		os.mkdir('/root/Files')
 
-	for filename in os.listdir('/root/initfiles'):
-		outfilename = '/root/Files/' + filename
-		try:
-			os.stat(outfilename)
-		except OSError:
-			print('  restoring', filename)
-			with open('/root/initfiles/' + filename, 'rb') as inf:
-				with open(outfilename, 'wb') as outf:
-					while True:
-						d = inf.read(256)
-						if len(d) == 0:
-							break
-						outf.write(d)
-						# flushing appears necessary to avoid "I/O Error"
-						# https://devforum.play.date/t/i-o-error-when-writing-files-from-c-coroutine/24137
-						outf.flush()
+	# the bundled files as an image loaded from the pdx by romfs.c, with the
+	# games precompiled so that their code runs in place without using the heap
+	rom = vfs.rom_ioctl(2, 0)
+	if isinstance(rom, int):
+		rom = None
+	else:
+		vfs.mount(vfs.VfsRom(rom), '/rom')
 
-	vfs.mount(VfsPD('Files'), '/')
+	# copies missing files in C, with the list of files coming from a manifest
+	# generated at build time, prints them, and returns (files, copied, ms,
+	# pristine)
+	pristine = sync_initfiles(rom is not None)[3]
+
+	# editable copies of the bundled games that are still unmodified are
+	# imported from /rom instead
+	vfs.mount(VfsPD('Files', mpycache=True, shadowed=pristine), '/')
 	os.umount('/root')
+	if rom is not None:
+		sys.path.insert(1, '/rom')
 
 init()
-del VfsPD, os, vfs, init
+del VfsPD, sync_initfiles, os, sys, vfs, init
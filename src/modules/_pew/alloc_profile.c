@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/bc.h"
+#include "py/gc.h"
+#include "py/mperrno.h"
+
+#include "alloc_profile.h"
+#include "dump_file.h"
+#if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
+#include "src/globals.h"
+// #else we are in the micropython_embed build which only preprocesses but does
+// not compile, and does not have the Playdate SDK
+#endif
+
+// Allocation profiler: while enabled, MICROPY_VM_HOOK_LOOP records the source
+// position of the running bytecode at every branch, and every allocation from
+// the GC heap is counted against the last recorded position. Allocations in
+// straight-line code are therefore attributed to the preceding branch (loop
+// iteration, if, call of a function containing a loop) in the same function,
+// allocations after a function return until the next branch to "?". Counting
+// allocations requires wrapping gc_alloc() and gc_realloc() at link time,
+// which is only available for the device, see the Makefile.
+
+#define ALLOC_PROFILE_SITES 256
+
+typedef struct {
+	qstr file;
+	qstr block;
+	uint32_t line;
+	uint32_t count;
+	uint32_t bytes;
+} alloc_site_t;
+
+// checked by MICROPY_VM_HOOK_LOOP and MICROPY_VM_HOOK_RETURN
+int pew_alloc_profile_enabled = 0;
+
+// in the C heap so that the profiler doesn't disturb what it's measuring
+static alloc_site_t *alloc_sites = NULL;
+// allocations that did not fit into alloc_sites any more
+static alloc_site_t alloc_overflow;
+static qstr alloc_site_file = MP_QSTRnull;
+static qstr alloc_site_block = MP_QSTRnull;
+static size_t alloc_site_line = 0;
+
+void pew_vm_source_site(void *code_state_in, const byte *ip, qstr *file, qstr *block, size_t *line) {
+	// same as the traceback code in mp_execute_bytecode()
+	mp_code_state_t *code_state = code_state_in;
+	const byte *bc = code_state->fun_bc->bytecode;
+	MP_BC_PRELUDE_SIG_DECODE(bc);
+	MP_BC_PRELUDE_SIZE_DECODE(bc);
+	const byte *line_info_top = bc + n_info;
+	const byte *bytecode_start = bc + n_info + n_cell;
+	qstr block_name = mp_decode_uint_value(bc);
+	for (size_t i = 0; i < 1 + n_pos_args + n_kwonly_args; ++i) {
+		bc = mp_decode_uint_skip(bc);
+	}
+	#if MICROPY_EMIT_BYTECODE_USES_QSTR_TABLE
+	*block = code_state->fun_bc->context->constants.qstr_table[block_name];
+	*file = code_state->fun_bc->context->constants.qstr_table[0];
+	#else
+	*block = block_name;
+	*file = code_state->fun_bc->context->constants.source_file;
+	#endif
+	*line = mp_bytecode_get_source_line(bc, line_info_top, ip - bytecode_start);
+	(void)n_state;
+	(void)n_exc_stack;
+	(void)scope_flags;
+	(void)n_def_pos_args;
+}
+
+void pew_alloc_profile_site(void *code_state, const byte *ip) {
+	if (code_state == NULL) {
+		alloc_site_file = MP_QSTRnull;
+		alloc_site_block = MP_QSTRnull;
+		alloc_site_line = 0;
+	}
+	else {
+		pew_vm_source_site(code_state, ip, &alloc_site_file, &alloc_site_block, &alloc_site_line);
+	}
+}
+
+static void alloc_profile_count(size_t n_bytes) {
+	uint32_t h = (alloc_site_file * 31u + alloc_site_block) * 131u + alloc_site_line;
+	for (size_t i = 0; i < ALLOC_PROFILE_SITES; i++) {
+		alloc_site_t *s = &alloc_sites[(h + i) % ALLOC_PROFILE_SITES];
+		if (s->count == 0) {
+			s->file = alloc_site_file;
+			s->block = alloc_site_block;
+			s->line = alloc_site_line;
+		}
+		else if (s->file != alloc_site_file || s->block != alloc_site_block || s->line != alloc_site_line) {
+			continue;
+		}
+		s->count++;
+		s->bytes += n_bytes;
+		return;
+	}
+	alloc_overflow.count++;
+	alloc_overflow.bytes += n_bytes;
+}
+
+#if defined(TARGET_PLAYDATE)
+
+void *__real_gc_alloc(size_t n_bytes, unsigned int alloc_flags);
+void *__real_gc_realloc(void *ptr, size_t n_bytes, bool allow_move);
+
+void *__wrap_gc_alloc(size_t n_bytes, unsigned int alloc_flags) {
+	if (pew_alloc_profile_enabled) {
+		alloc_profile_count(n_bytes);
+	}
+	return __real_gc_alloc(n_bytes, alloc_flags);
+}
+
+// growing a list or similar, counted as an allocation of the new size even
+// if it can be done in place
+void *__wrap_gc_realloc(void *ptr, size_t n_bytes, bool allow_move) {
+	if (pew_alloc_profile_enabled && n_bytes > 0) {
+		alloc_profile_count(n_bytes);
+	}
+	return __real_gc_realloc(ptr, n_bytes, allow_move);
+}
+
+#endif
+
+// _pew.alloc_profile(enable): start counting allocations from scratch, or stop
+static mp_obj_t pew_alloc_profile(mp_obj_t enable) {
+	#if !defined(TARGET_PLAYDATE)
+	mp_raise_OSError(MP_EOPNOTSUPP);
+	#endif
+	if (mp_obj_is_true(enable)) {
+		if (alloc_sites == NULL) {
+			alloc_sites = global_pd->system->realloc(NULL, ALLOC_PROFILE_SITES * sizeof(alloc_site_t));
+			if (alloc_sites == NULL) {
+				mp_raise_OSError(MP_ENOMEM);
+			}
+		}
+		memset(alloc_sites, 0, ALLOC_PROFILE_SITES * sizeof(alloc_site_t));
+		memset(&alloc_overflow, 0, sizeof(alloc_overflow));
+		pew_alloc_profile_site(NULL, NULL);
+		pew_alloc_profile_enabled = 1;
+	}
+	else {
+		pew_alloc_profile_enabled = 0;
+	}
+	return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_1(pew_alloc_profile_obj, pew_alloc_profile);
+
+// Heap map: one character per block, '.' free, 'h' head of an allocation,
+// '=' tail, 'm' marked (only seen during a collection). The allocation table
+// has 2 bits per block, see gc.c.
+static void alloc_dump_heap_map(const mp_print_t *print) {
+	char line[65];
+	size_t index = 0;
+	for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = area->next) {
+		size_t blocks = area->gc_alloc_table_byte_len * 4;
+		mp_printf(print, "area %u %u %u\n", (unsigned int)index++, (unsigned int)blocks, (unsigned int)MICROPY_BYTES_PER_GC_BLOCK);
+		size_t n = 0;
+		for (size_t b = 0; b < blocks; b++) {
+			line[n++] = ".h=m"[(area->gc_alloc_table_start[b / 4] >> (2 * (b % 4))) & 3];
+			if (n == 64 || b == blocks - 1) {
+				line[n] = '\0';
+				mp_printf(print, "%s\n", line);
+				n = 0;
+			}
+		}
+	}
+}
+
+// _pew.alloc_dump([path]): write the allocation counts per site and the heap
+// map to the file at path in the data folder, or to stdout. See
+// allocreport.py for the format and for summarizing it.
+static mp_obj_t pew_alloc_dump(size_t n_args, const mp_obj_t *args) {
+	pew_dump_file_t d;
+	pew_dump_open(&d, (n_args > 0) ? args[0] : MP_OBJ_NULL);
+	const mp_print_t *print = &d.print;
+	// Nothing in here allocates from the GC heap, so the file is always closed.
+	mp_printf(print, "pewpew-alloc 1\n");
+	if (alloc_sites != NULL) {
+		for (size_t i = 0; i < ALLOC_PROFILE_SITES; i++) {
+			alloc_site_t *s = &alloc_sites[i];
+			if (s->count > 0) {
+				mp_printf(print, "site %u %u %s:%u %s\n", (unsigned int)s->count, (unsigned int)s->bytes, pew_dump_qstr(s->file), (unsigned int)s->line, pew_dump_qstr(s->block));
+			}
+		}
+		if (alloc_overflow.count > 0) {
+			mp_printf(print, "site %u %u ?:0 (overflow)\n", (unsigned int)alloc_overflow.count, (unsigned int)alloc_overflow.bytes);
+		}
+	}
+	alloc_dump_heap_map(print);
+	pew_dump_close(&d);
+	return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(pew_alloc_dump_obj, 0, 1, pew_alloc_dump);
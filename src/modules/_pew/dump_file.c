@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/mperrno.h"
+
+#include "dump_file.h"
+#if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
+#include "src/globals.h"
+// #else we are in the micropython_embed build which only preprocesses but does
+// not compile, and does not have the Playdate SDK
+#endif
+
+static void pew_dump_flush(pew_dump_file_t *d) {
+	if (d->len > 0 && !d->error) {
+		// flushing appears necessary to avoid "I/O Error" when writing from the
+		// Python coroutine, see vfs_pd_file.c
+		if (global_pd->file->write(d->f, d->buf, d->len) != (int)d->len
+			|| global_pd->file->flush(d->f) < 0)
+		{
+			d->error = true;
+		}
+	}
+	d->len = 0;
+}
+
+static void pew_dump_strn(void *data, const char *str, size_t len) {
+	pew_dump_file_t *d = data;
+	while (len > 0) {
+		size_t n = sizeof(d->buf) - d->len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(d->buf + d->len, str, n);
+		d->len += n;
+		str += n;
+		len -= n;
+		if (d->len == sizeof(d->buf)) {
+			pew_dump_flush(d);
+		}
+	}
+}
+
+void pew_dump_open(pew_dump_file_t *d, mp_obj_t path) {
+	d->print = mp_plat_print;
+	d->f = NULL;
+	d->len = 0;
+	d->error = false;
+	if (path != MP_OBJ_NULL && path != mp_const_none) {
+		d->f = global_pd->file->open(mp_obj_str_get_str(path), kFileWrite);
+		if (d->f == NULL) {
+			mp_raise_OSError(MP_EIO);
+		}
+		d->print.data = d;
+		d->print.print_strn = pew_dump_strn;
+	}
+}
+
+void pew_dump_close(pew_dump_file_t *d) {
+	if (d->f == NULL) {
+		return;
+	}
+	pew_dump_flush(d);
+	bool ok = (global_pd->file->close(d->f) == 0) && !d->error;
+	d->f = NULL;
+	if (!ok) {
+		mp_raise_OSError(MP_EIO);
+	}
+}
+
+const char *pew_dump_qstr(qstr q) {
+	return (q == MP_QSTRnull) ? "?" : qstr_str(q);
+}
@@ -0,0 +1,47 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include "py/obj.h"
+#include "py/mpprint.h"
+
+// Output of the _pew.*_dump() functions: a file in the data folder, written
+// through a buffer, or stdout.
+typedef struct {
+	mp_print_t print;
+	// an SDFile *, or NULL for stdout
+	void *f;
+	size_t len;
+	bool error;
+	byte buf[256];
+} pew_dump_file_t;
+
+// Point d->print at the file at path, or at stdout if path is MP_OBJ_NULL or
+// None. Raises OSError if the file can't be opened.
+void pew_dump_open(pew_dump_file_t *d, mp_obj_t path);
+// Write out the rest, flush and close the file. Raises OSError if anything
+// could not be written. Nothing printed to d->print may allocate from the GC
+// heap in between, so that the file is always closed.
+void pew_dump_close(pew_dump_file_t *d);
+// Name of q for the dump formats, "?" for MP_QSTRnull.
+const char *pew_dump_qstr(qstr q);
@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "py/runtime.h"
+
+#include "events.h"
+#if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
+#include "src/input.h"
+// #else we are in the micropython_embed build which only preprocesses but does
+// not compile, and does not have the Playdate SDK
+#endif
+
+// The iterator returned by _pew.events() is also the event it yields: each
+// step loads the next event from the queue (see src/input.h) into it, so that
+// reading input allocates nothing (except for the crank attribute, a float).
+typedef struct {
+	mp_obj_base_t base;
+	InputEvent event;
+} pew_events_obj_t;
+
+static mp_obj_t pew_events_iternext(mp_obj_t self_in) {
+	pew_events_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	if (!inputPop(&self->event)) {
+		return MP_OBJ_STOP_ITERATION;
+	}
+	return self_in;
+}
+
+static void pew_events_attr(mp_obj_t self_in, qstr attr, mp_obj_t *dest) {
+	if (dest[0] != MP_OBJ_NULL) {
+		// store or delete: not supported
+		return;
+	}
+	pew_events_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	switch (attr) {
+		case MP_QSTR_kind:
+			dest[0] = MP_OBJ_NEW_SMALL_INT(self->event.kind);
+			break;
+		case MP_QSTR_button:
+			dest[0] = MP_OBJ_NEW_SMALL_INT(self->event.button);
+			break;
+		case MP_QSTR_time:
+			dest[0] = mp_obj_new_int_from_uint(self->event.ms);
+			break;
+		case MP_QSTR_crank:
+			dest[0] = mp_obj_new_float(self->event.crank);
+			break;
+		case MP_QSTR_dropped:
+			dest[0] = mp_obj_new_int_from_uint(inputDropped());
+			break;
+	}
+}
+
+static MP_DEFINE_CONST_OBJ_TYPE(
+	pew_type_events,
+	MP_QSTR_Events,
+	MP_TYPE_FLAG_ITER_IS_ITERNEXT,
+	iter, pew_events_iternext,
+	attr, pew_events_attr
+	);
+
+static pew_events_obj_t pew_events_singleton = { { &pew_type_events } };
+
+// _pew.events(): iterate over the button presses and releases (kind
+// _pew.PRESS or _pew.RELEASE, button one of the bits returned by
+// _pew.keys()) and crank movements (kind _pew.CRANK, crank in degrees) since
+// the last call, in the order they happened, with time in milliseconds.
+// Attribute dropped counts events lost because they were not read in time
+// (the oldest ones go first). Events are only collected from the first call
+// on.
+static mp_obj_t pew_events(void) {
+	return MP_OBJ_FROM_PTR(&pew_events_singleton);
+}
+MP_DEFINE_CONST_FUN_OBJ_0(pew_events_obj, pew_events);
@@ -0,0 +1,353 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "py/mphal.h"
+
+#include "initfiles.h"
+#include "vfs_pd.h"
+#if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
+#include "src/globals.h"
+// #else we are in the micropython_embed build which only preprocesses but does
+// not compile, and does not have the Playdate SDK
+#endif
+
+// Generated by mkinitmanifest.py at build time, in the pdx. One line per file
+// in initfiles/: "<size> <FNV-1a hash in hex> <name>\n".
+#define INITFILES_MANIFEST "initfiles.manifest"
+// Copy of the manifest as of the last sync, in the data folder.
+#define INITFILES_INSTALLED "initfiles.installed"
+#define INITFILES_SRC "initfiles/"
+#define INITFILES_DST_DIR "Files"
+#define INITFILES_DST INITFILES_DST_DIR "/"
+#define INITFILES_COPY_BUFSIZE 4096
+
+// All buffers here are allocated outside of the MicroPython heap, which is
+// small and may be fragmented already, and nothing in here raises while they
+// are held.
+
+typedef struct {
+	char *buf;
+	int len;
+	// set if memory ran out while appending to buf
+	int oom;
+} initfiles_text_t;
+
+static void initfiles_free(void *p) {
+	if (p != NULL) {
+		global_pd->system->realloc(p, 0);
+	}
+}
+
+// Read a whole file into a NUL-terminated buffer, or return buf == NULL if it
+// cannot be read.
+static initfiles_text_t initfiles_read_all(const char *path, FileOptions mode) {
+	initfiles_text_t t = { NULL, 0, 0 };
+	SDFile *f = global_pd->file->open(path, mode);
+	if (f == NULL) {
+		return t;
+	}
+	int alloc = 0;
+	for (;;) {
+		if (alloc - t.len < 256) {
+			alloc += 1024;
+			char *b = global_pd->system->realloc(t.buf, alloc);
+			if (b == NULL) {
+				initfiles_free(t.buf);
+				t.buf = NULL;
+				break;
+			}
+			t.buf = b;
+		}
+		int n = global_pd->file->read(f, t.buf + t.len, alloc - t.len - 1);
+		if (n < 0) {
+			initfiles_free(t.buf);
+			t.buf = NULL;
+			break;
+		}
+		if (n == 0) {
+			t.buf[t.len] = '\0';
+			break;
+		}
+		t.len += n;
+	}
+	global_pd->file->close(f);
+	return t;
+}
+
+static void initfiles_list_callback(const char *filename, void *userdata) {
+	initfiles_text_t *t = userdata;
+	int n = strlen(filename) + 1;
+	char *b = global_pd->system->realloc(t->buf, t->len + n);
+	if (b == NULL) {
+		t->oom = 1;
+		return;
+	}
+	t->buf = b;
+	memcpy(t->buf + t->len, filename, n);
+	t->len += n;
+}
+
+static int initfiles_list_contains(const initfiles_text_t *list, const char *name, int namelen) {
+	const char *p = list->buf;
+	const char *end = list->buf + list->len;
+	while (p < end) {
+		int n = strlen(p);
+		if (n == namelen && memcmp(p, name, namelen) == 0) {
+			return 1;
+		}
+		p += n + 1;
+	}
+	return 0;
+}
+
+// Find the line for name in a manifest, return a pointer to its start or NULL.
+static const char *initfiles_find_line(const initfiles_text_t *manifest, const char *name, int namelen) {
+	if (manifest->buf == NULL) {
+		return NULL;
+	}
+	const char *line = manifest->buf;
+	while (*line != '\0') {
+		const char *nl = strchr(line, '\n');
+		const char *end = (nl != NULL) ? nl : line + strlen(line);
+		const char *sp = memchr(line, ' ', end - line);
+		sp = (sp != NULL) ? memchr(sp + 1, ' ', end - sp - 1) : NULL;
+		if (sp != NULL && end - sp - 1 == namelen && memcmp(sp + 1, name, namelen) == 0) {
+			return line;
+		}
+		if (nl == NULL) {
+			break;
+		}
+		line = nl + 1;
+	}
+	return NULL;
+}
+
+// Compute size and hash of a file the same way as mkinitmanifest.py and
+// format them like the start of a manifest line. Returns 0 on success.
+static int initfiles_describe(const char *path, byte *buf, char *out, size_t outlen) {
+	SDFile *f = global_pd->file->open(path, kFileReadData);
+	if (f == NULL) {
+		return -1;
+	}
+	uint32_t hash = 2166136261u;
+	unsigned int size = 0;
+	int n;
+	while ((n = global_pd->file->read(f, buf, INITFILES_COPY_BUFSIZE)) > 0) {
+		for (int i = 0; i < n; i++) {
+			hash = (hash ^ buf[i]) * 16777619u;
+		}
+		size += n;
+	}
+	global_pd->file->close(f);
+	if (n < 0) {
+		return -1;
+	}
+	snprintf(out, outlen, "%u %08x ", size, (unsigned int)hash);
+	return 0;
+}
+
+static int initfiles_copy(const char *src, const char *dst, byte *buf) {
+	SDFile *in = global_pd->file->open(src, kFileRead);
+	if (in == NULL) {
+		return -1;
+	}
+	SDFile *out = global_pd->file->open(dst, kFileWrite);
+	if (out == NULL) {
+		global_pd->file->close(in);
+		return -1;
+	}
+	int res = 0;
+	int n;
+	while ((n = global_pd->file->read(in, buf, INITFILES_COPY_BUFSIZE)) > 0) {
+		if (global_pd->file->write(out, buf, n) != n
+			// flushing appears necessary to avoid "I/O Error"
+			// https://devforum.play.date/t/i-o-error-when-writing-files-from-c-coroutine/24137
+			|| global_pd->file->flush(out) < 0)
+		{
+			res = -1;
+			break;
+		}
+	}
+	if (n < 0) {
+		res = -1;
+	}
+	global_pd->file->close(out);
+	global_pd->file->close(in);
+	return res;
+}
+
+// _pew.sync_initfiles([find_pristine]): Copy every file listed in the manifest
+// that is missing in Files/. Files that are present are left alone as they may
+// have been modified by the user, unless the bundled version changed since the
+// last sync and the present one is still identical to the previous bundled
+// version.
+// Returns (number of files in the manifest, number copied, milliseconds taken,
+// list of pristine .py and .mpy files). The list is only filled if
+// find_pristine is true, as that requires reading every present module file to
+// compare it with the bundled version.
+static mp_obj_t pew_sync_initfiles(size_t n_args, const mp_obj_t *args) {
+	bool find_pristine = (n_args > 0 && mp_obj_is_true(args[0]));
+	unsigned int start = global_pd->system->getCurrentTimeMilliseconds();
+	initfiles_text_t manifest = initfiles_read_all(INITFILES_MANIFEST, kFileRead);
+	if (manifest.buf == NULL) {
+		mp_raise_OSError(MP_ENOENT);
+	}
+	initfiles_text_t installed = initfiles_read_all(INITFILES_INSTALLED, kFileReadData);
+	int changed = (installed.buf == NULL || strcmp(installed.buf, manifest.buf) != 0);
+	initfiles_text_t present = { NULL, 0, 0 };
+	// names of pristine module files, NUL-terminated, in the same format as present
+	initfiles_text_t pristine = { NULL, 0, 0 };
+	global_pd->file->listfiles(INITFILES_DST_DIR, &initfiles_list_callback, &present, true);
+	byte *buf = global_pd->system->realloc(NULL, INITFILES_COPY_BUFSIZE);
+	if (present.oom || buf == NULL) {
+		// with an incomplete list, files the user edited would look missing and
+		// be overwritten
+		initfiles_free(buf);
+		initfiles_free(present.buf);
+		initfiles_free(installed.buf);
+		initfiles_free(manifest.buf);
+		mp_raise_OSError(MP_ENOMEM);
+	}
+
+	char path[128];
+	char desc[32];
+	int nfiles = 0;
+	int ncopied = 0;
+	int failed = 0;
+	const char *line = manifest.buf;
+	while (*line != '\0') {
+		const char *nl = strchr(line, '\n');
+		int linelen = (nl != NULL) ? nl - line : (int)strlen(line);
+		const char *name = memchr(line, ' ', linelen);
+		name = (name != NULL) ? memchr(name + 1, ' ', line + linelen - name - 1) : NULL;
+		if (name != NULL) {
+			name++;
+			int namelen = line + linelen - name;
+			nfiles++;
+			int copy = 0;
+			int is_module = (namelen > 3 && memcmp(name + namelen - 3, ".py", 3) == 0)
+				|| (namelen > 4 && memcmp(name + namelen - 4, ".mpy", 4) == 0);
+			int same = 0;
+			if (!initfiles_list_contains(&present, name, namelen)) {
+				copy = 1;
+			}
+			else if (changed) {
+				const char *old = initfiles_find_line(&installed, name, namelen);
+				if (old != NULL && (strncmp(old, line, linelen) != 0 || old[linelen] != '\n')) {
+					// bundled version changed, update if the user didn't modify it
+					snprintf(path, sizeof(path), INITFILES_DST "%.*s", namelen, name);
+					// desc ends with a space, so this matches size and hash exactly
+					if (initfiles_describe(path, buf, desc, sizeof(desc)) == 0
+						&& strncmp(old, desc, strlen(desc)) == 0)
+					{
+						copy = 1;
+					}
+				}
+			}
+			if (copy) {
+				mp_printf(&mp_plat_print, "  restoring %.*s\n", namelen, name);
+				char src[128];
+				snprintf(src, sizeof(src), INITFILES_SRC "%.*s", namelen, name);
+				snprintf(path, sizeof(path), INITFILES_DST "%.*s", namelen, name);
+				if (initfiles_copy(src, path, buf) == 0) {
+					ncopied++;
+					same = 1;
+				}
+				else {
+					failed = 1;
+				}
+			}
+			else if (find_pristine && is_module) {
+				snprintf(path, sizeof(path), INITFILES_DST "%.*s", namelen, name);
+				same = (initfiles_describe(path, buf, desc, sizeof(desc)) == 0
+					&& strncmp(line, desc, strlen(desc)) == 0);
+			}
+			if (find_pristine && is_module && same) {
+				// if memory runs out, the file is just not shadowed, which is
+				// harmless
+				char *b = global_pd->system->realloc(pristine.buf, pristine.len + namelen + 1);
+				if (b != NULL) {
+					pristine.buf = b;
+					memcpy(pristine.buf + pristine.len, name, namelen);
+					pristine.buf[pristine.len + namelen] = '\0';
+					pristine.len += namelen + 1;
+				}
+			}
+		}
+		if (nl == NULL) {
+			break;
+		}
+		line = nl + 1;
+	}
+
+	if (changed && !failed) {
+		SDFile *f = global_pd->file->open(INITFILES_INSTALLED, kFileWrite);
+		if (f != NULL) {
+			// flushing appears necessary to avoid "I/O Error", see initfiles_copy()
+			int ok = global_pd->file->write(f, manifest.buf, manifest.len) == manifest.len
+				&& global_pd->file->flush(f) >= 0;
+			ok = (global_pd->file->close(f) == 0) && ok;
+			if (!ok) {
+				// a partial copy would be compared against next time, without
+				// one present files are left alone
+				global_pd->file->unlink(INITFILES_INSTALLED, false);
+			}
+		}
+	}
+	if (ncopied > 0) {
+		vfs_pd_cache_invalidate();
+	}
+
+	initfiles_free(buf);
+	initfiles_free(present.buf);
+	initfiles_free(installed.buf);
+	initfiles_free(manifest.buf);
+
+	mp_obj_t list;
+	nlr_buf_t nlr;
+	if (nlr_push(&nlr) == 0) {
+		list = mp_obj_new_list(0, NULL);
+		for (const char *p = pristine.buf; p < pristine.buf + pristine.len; p += strlen(p) + 1) {
+			mp_obj_list_append(list, mp_obj_new_str_from_cstr(p));
+		}
+		nlr_pop();
+	}
+	else {
+		initfiles_free(pristine.buf);
+		nlr_jump(nlr.ret_val);
+	}
+	initfiles_free(pristine.buf);
+
+	mp_obj_t t[4] = {
+		MP_OBJ_NEW_SMALL_INT(nfiles),
+		MP_OBJ_NEW_SMALL_INT(ncopied),
+		MP_OBJ_NEW_SMALL_INT(global_pd->system->getCurrentTimeMilliseconds() - start),
+		list,
+	};
+	return mp_obj_new_tuple(4, t);
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(pew_sync_initfiles_obj, 0, 1, pew_sync_initfiles);
@@ -0,0 +1,210 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "extmod/vfs.h"
+
+#include "load_async.h"
+#include "vfs_pd.h"
+#if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
+#include "src/globals.h"
+// #else we are in the micropython_embed build which only preprocesses but does
+// not compile, and does not have the Playdate SDK
+#endif
+
+#define LOAD_ASYNC_DEFAULT_CHUNK 2048
+
+// Handle returned by _pew.load_async(). Pending handles are kept in a linked
+// list from a root pointer, which also keeps them and their buffers alive
+// while update() is filling them.
+typedef struct _pew_load_async_t {
+	mp_obj_base_t base;
+	struct _pew_load_async_t *next;
+	SDFile *sdfile;
+	mp_obj_t buffer;
+	// length of buffer when the load started
+	size_t len;
+	size_t pos;
+	size_t chunk;
+	int total;
+	int error;
+	bool done;
+} pew_load_async_t;
+
+MP_REGISTER_ROOT_POINTER(struct _pew_load_async_t *pew_load_async_head);
+
+static void pew_load_async_finish(pew_load_async_t *self, int error) {
+	global_pd->file->close(self->sdfile);
+	self->sdfile = NULL;
+	self->error = error;
+	self->done = true;
+}
+
+void pew_load_async_step(void) {
+	pew_load_async_t **link = &MP_STATE_VM(pew_load_async_head);
+	while (*link != NULL) {
+		pew_load_async_t *self = *link;
+		size_t n = self->len - self->pos;
+		if (n > self->chunk) {
+			n = self->chunk;
+		}
+		// Python may have resized buffer since the last step, which moves the
+		// contents of a bytearray, so don't keep a pointer into it
+		mp_buffer_info_t bufinfo;
+		if (!mp_get_buffer(self->buffer, &bufinfo, MP_BUFFER_WRITE) || bufinfo.len < self->pos + n) {
+			pew_load_async_finish(self, MP_EINVAL);
+			*link = self->next;
+			self->next = NULL;
+			continue;
+		}
+		int res = (n > 0) ? global_pd->file->read(self->sdfile, (byte *)bufinfo.buf + self->pos, n) : 0;
+		if (res > 0) {
+			self->pos += res;
+		}
+		if (res <= 0 || self->pos == self->len) {
+			pew_load_async_finish(self, (res < 0) ? MP_EIO : 0);
+			*link = self->next;
+			self->next = NULL;
+		}
+		else {
+			link = &self->next;
+		}
+	}
+}
+
+void pew_load_async_deinit(void) {
+	pew_load_async_t *self = MP_STATE_VM(pew_load_async_head);
+	while (self != NULL) {
+		pew_load_async_t *next = self->next;
+		pew_load_async_finish(self, MP_ECANCELED);
+		self->next = NULL;
+		self = next;
+	}
+	MP_STATE_VM(pew_load_async_head) = NULL;
+}
+
+// done(): whether the load has finished, successfully or not
+static mp_obj_t pew_load_async_done(mp_obj_t self_in) {
+	pew_load_async_t *self = MP_OBJ_TO_PTR(self_in);
+	return mp_obj_new_bool(self->done);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(pew_load_async_done_obj, pew_load_async_done);
+
+// progress(): (bytes read so far, file size or -1 if unknown)
+static mp_obj_t pew_load_async_progress(mp_obj_t self_in) {
+	pew_load_async_t *self = MP_OBJ_TO_PTR(self_in);
+	mp_obj_t t[2] = {
+		mp_obj_new_int_from_uint(self->pos),
+		MP_OBJ_NEW_SMALL_INT(self->total),
+	};
+	return mp_obj_new_tuple(2, t);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(pew_load_async_progress_obj, pew_load_async_progress);
+
+// result(): number of bytes read into the buffer, raises OSError if the load
+// failed or hasn't finished yet (EAGAIN)
+static mp_obj_t pew_load_async_result(mp_obj_t self_in) {
+	pew_load_async_t *self = MP_OBJ_TO_PTR(self_in);
+	if (!self->done) {
+		mp_raise_OSError(MP_EAGAIN);
+	}
+	if (self->error != 0) {
+		mp_raise_OSError(self->error);
+	}
+	return mp_obj_new_int_from_uint(self->pos);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(pew_load_async_result_obj, pew_load_async_result);
+
+// Iterating (or awaiting, which in MicroPython is the same as yield from)
+// yields None until the load has finished, then stops with the result.
+static mp_obj_t pew_load_async_iternext(mp_obj_t self_in) {
+	pew_load_async_t *self = MP_OBJ_TO_PTR(self_in);
+	if (!self->done) {
+		return mp_const_none;
+	}
+	return mp_make_stop_iteration(pew_load_async_result(self_in));
+}
+
+static const mp_rom_map_elem_t pew_load_async_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_done), MP_ROM_PTR(&pew_load_async_done_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_progress), MP_ROM_PTR(&pew_load_async_progress_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_result), MP_ROM_PTR(&pew_load_async_result_obj) },
+};
+static MP_DEFINE_CONST_DICT(pew_load_async_locals_dict, pew_load_async_locals_dict_table);
+
+static MP_DEFINE_CONST_OBJ_TYPE(
+	pew_type_load_async,
+	MP_QSTR_LoadAsync,
+	MP_TYPE_FLAG_ITER_IS_ITERNEXT,
+	iter, pew_load_async_iternext,
+	locals_dict, &pew_load_async_locals_dict
+	);
+
+// _pew.load_async(path, buffer, *, chunk=2048): Start reading the file at path
+// (which must be on a VfsPD) into buffer, at most chunk bytes per frame, while
+// Python keeps running. If buffer shrinks before the load is done, the load
+// fails with EINVAL.
+static mp_obj_t pew_load_async(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	enum { ARG_path, ARG_buffer, ARG_chunk };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_path, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+		{ MP_QSTR_buffer, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+		{ MP_QSTR_chunk, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = LOAD_ASYNC_DEFAULT_CHUNK} },
+	};
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(args[ARG_buffer].u_obj, &bufinfo, MP_BUFFER_WRITE);
+	if (args[ARG_chunk].u_int <= 0) {
+		mp_raise_ValueError(NULL);
+	}
+
+	const char *path_out;
+	mp_vfs_mount_t *vfs = mp_vfs_lookup_path(mp_obj_str_get_str(args[ARG_path].u_obj), &path_out);
+	if (vfs == MP_VFS_NONE || vfs == MP_VFS_ROOT || !mp_obj_is_type(vfs->obj, &mp_type_vfs_pd)) {
+		mp_raise_OSError(MP_ENOENT);
+	}
+	const char *path = vfs_pd_make_path_str(MP_OBJ_TO_PTR(vfs->obj), path_out);
+
+	pew_load_async_t *self = mp_obj_malloc(pew_load_async_t, &pew_type_load_async);
+	self->sdfile = global_pd->file->open(path, kFileRead|kFileReadData);
+	if (self->sdfile == NULL) {
+		raise_OSError_pd();
+	}
+	self->total = -1;
+	if (global_pd->file->seek(self->sdfile, 0, SEEK_END) >= 0) {
+		self->total = global_pd->file->tell(self->sdfile);
+		global_pd->file->seek(self->sdfile, 0, SEEK_SET);
+	}
+	self->buffer = args[ARG_buffer].u_obj;
+	self->len = bufinfo.len;
+	self->pos = 0;
+	self->chunk = args[ARG_chunk].u_int;
+	self->error = 0;
+	self->done = false;
+	self->next = MP_STATE_VM(pew_load_async_head);
+	MP_STATE_VM(pew_load_async_head) = self;
+	return MP_OBJ_FROM_PTR(self);
+}
+MP_DEFINE_CONST_FUN_OBJ_KW(pew_load_async_obj, 2, pew_load_async);
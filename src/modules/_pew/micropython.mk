@@ -1,3 +1,3 @@
 _PEW_MOD_DIR := $(USERMOD_DIR)
-SRC_USERMOD_C += $(_PEW_MOD_DIR)/mod_pew.c $(_PEW_MOD_DIR)/vfs_pd.c $(_PEW_MOD_DIR)/vfs_pd_file.c
+SRC_USERMOD_C += $(_PEW_MOD_DIR)/mod_pew.c $(_PEW_MOD_DIR)/vfs_pd.c $(_PEW_MOD_DIR)/vfs_pd_file.c $(_PEW_MOD_DIR)/vfs_pd_mpycache.c $(_PEW_MOD_DIR)/initfiles.c $(_PEW_MOD_DIR)/load_async.c $(_PEW_MOD_DIR)/alloc_profile.c $(_PEW_MOD_DIR)/sample_profile.c $(_PEW_MOD_DIR)/dump_file.c $(_PEW_MOD_DIR)/native_check.c $(_PEW_MOD_DIR)/events.c $(_PEW_MOD_DIR)/mod_save.c
 QSTR_DEFS += $(_PEW_MOD_DIR)/qstrdefs.h
@@ -20,14 +20,27 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include <stdlib.h>
+
 #include "py/runtime.h"
 #include "py/objstr.h"
 #include "py/mphal.h"
+#include "py/mperrno.h"
 
 #include "vfs_pd.h"
+#include "initfiles.h"
+#include "load_async.h"
+#include "alloc_profile.h"
+#include "sample_profile.h"
+#include "events.h"
+#include "dump_file.h"
+#include "mod_save.h"
 
 #if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
 #include "src/display.h"
+#include "src/globals.h"
+#include "src/framestats.h"
+#include "src/trace.h"
 // #else we are in the micropython_embed build which only preprocesses but does
 // not compile, and does not have the Playdate SDK
 #endif
@@ -35,36 +48,324 @@ THE SOFTWARE.
 static MP_DEFINE_CONST_FUN_OBJ_2(show_obj, displayShow);
 static MP_DEFINE_CONST_FUN_OBJ_0(keys_obj, displayKeys);
 
-static mp_obj_t tick(mp_obj_t delta_s) {
-	static mp_int_t nextTick = 0;
-	static uint8_t nextTickInitialized = 0;
-	mp_int_t delta_ms = (mp_int_t)(1000*mp_obj_get_float(delta_s));
-	mp_int_t now = mp_hal_ticks_ms();
-	if (!nextTickInitialized) {
-		nextTick = now;
-		nextTickInitialized = 1;
+// What tick() does when a tick is already overdue: return right away and
+// keep the schedule so that the game catches up, move the schedule ahead by
+// whole ticks (the game slows down but stays in step), or restart the schedule
+// from now.
+enum {
+	PEW_TICK_CATCHUP,
+	PEW_TICK_SKIP,
+	PEW_TICK_RESET
+};
+// TICK_CATCHUP falls back to TICK_SKIP when more than this many ticks behind,
+// so that a long stall is not followed by a long burst
+#define PEW_TICK_MAX_CATCHUP 8
+
+static struct {
+	uint64_t next;
+	bool initialized;
+	uint32_t ticks;
+	uint32_t late;
+	uint32_t skipped;
+} tickState;
+
+// _pew.tick(delta_s[, policy]): wait until delta_s seconds after the previous
+// tick's scheduled time, returns how late this tick is in microseconds (an
+// int, so that a game loop doesn't allocate a float every frame)
+static mp_obj_t tick(size_t n_args, const mp_obj_t *args) {
+	mp_float_t delta_s = mp_obj_get_float(args[0]);
+	if (delta_s < 0) {
+		mp_raise_ValueError(NULL);
 	}
-	nextTick += delta_ms;
-	if (nextTick - now < 0) {
-		nextTick = now;
+	uint64_t delta = (uint64_t)(MICROPY_FLOAT_CONST(1e6) * delta_s);
+	mp_int_t policy = (n_args > 1) ? mp_obj_get_int(args[1]) : PEW_TICK_RESET;
+	if (policy < PEW_TICK_CATCHUP || policy > PEW_TICK_RESET) {
+		mp_raise_ValueError(NULL);
+	}
+	if (frameRateAuto && delta > 0) {
+		frameRateSet(MICROPY_FLOAT_CONST(1e6) / delta);
+	}
+	uint64_t now = pd_hal_ticks_us64();
+	if (!tickState.initialized) {
+		tickState.next = now;
+		tickState.initialized = true;
+	}
+	tickState.next += delta;
+	tickState.ticks++;
+	if ((int64_t)(tickState.next - now) < 0) {
+		tickState.late++;
+		uint64_t behind = now - tickState.next;
+		if (policy == PEW_TICK_CATCHUP && behind > PEW_TICK_MAX_CATCHUP * delta) {
+			policy = PEW_TICK_SKIP;
+		}
+		if (policy == PEW_TICK_CATCHUP) {
+			return mp_obj_new_int_from_ull(behind);
+		}
+		if (policy == PEW_TICK_RESET || delta == 0) {
+			tickState.next = now;
+			return mp_obj_new_int_from_ull(behind);
+		}
+		uint64_t skip = behind / delta + 1;
+		tickState.next += skip * delta;
+		tickState.skipped += skip;
 	}
 	while (1) {
-		mp_int_t remaining = nextTick - now;
+		now = pd_hal_ticks_us64();
+		int64_t remaining = tickState.next - now;
 		if (remaining <= 0) {
 			break;
 		}
-		mp_event_wait_ms(remaining);
-		now = mp_hal_ticks_ms();
+		if ((int)(global_pd->system->getCurrentTimeMilliseconds() + (remaining + 999) / 1000 - updateEndDue) > 0) {
+			// not in this frame: sleep until the next update(), collecting
+			// garbage if there is time
+			mp_event_wait_indefinite();
+		}
+		else {
+			// within this frame: wait here, so that tick periods that are not
+			// a whole number of frames are kept exactly
+			mp_event_handle_nowait();
+		}
+	}
+	return mp_obj_new_int_from_ull(now - tickState.next);
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(tick_obj, 1, 2, tick);
+
+// _pew.set_fps(fps): fix the display refresh rate (clamped to 10-50), or let
+// it follow the tick rate again if None
+static mp_obj_t set_fps(mp_obj_t fps) {
+	if (fps == mp_const_none) {
+		frameRateAuto = 1;
 	}
+	else {
+		frameRateAuto = 0;
+		frameRateSet(mp_obj_get_float(fps));
+	}
+	return mp_obj_new_float(frameRate);
+}
+MP_DEFINE_CONST_FUN_OBJ_1(set_fps_obj, set_fps);
+
+// _pew.tick_stats(): number of ticks, of those that were already overdue, and
+// of ticks skipped by TICK_SKIP
+static mp_obj_t tick_stats(void) {
+	mp_obj_t d = mp_obj_new_dict(3);
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_ticks), mp_obj_new_int_from_uint(tickState.ticks));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_late), mp_obj_new_int_from_uint(tickState.late));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_skipped), mp_obj_new_int_from_uint(tickState.skipped));
+	return d;
+}
+MP_DEFINE_CONST_FUN_OBJ_0(tick_stats_obj, tick_stats);
+
+// _pew.poll(): what MICROPY_VM_HOOK_POLL does at every bytecode branch, for
+// loops in @micropython.native and @micropython.viper code, which never run
+// the VM hooks: yield to the system if the time of the current update() is up,
+// and handle pending exceptions such as KeyboardInterrupt.
+static mp_obj_t poll(void) {
+	mp_event_handle_nowait();
+	#if defined(TARGET_PLAYDATE) && PEW_CYCLE_COUNTER
+	if ((int32_t)(*(volatile uint32_t *)0xE0001004 - pd_hal_yield_cycles) >= 0) {
+		pd_hal_vm_yield();
+	}
+	#else
+	pd_hal_wfe_ms(0);
+	#endif
+	return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_0(poll_obj, poll);
+
+// _pew.heap_info(): (number of heap regions, their total size in bytes, size
+// in bytes up to which the heap may grow)
+static mp_obj_t heap_info(void) {
+	size_t regions, total, limit;
+	pd_hal_heap_info(&regions, &total, &limit);
+	mp_obj_t t[3] = {
+		mp_obj_new_int_from_uint(regions),
+		mp_obj_new_int_from_uint(total),
+		mp_obj_new_int_from_uint(limit),
+	};
+	return mp_obj_new_tuple(3, t);
+}
+MP_DEFINE_CONST_FUN_OBJ_0(heap_info_obj, heap_info);
+
+// _pew.stack_info(): (size of the Python stack in bytes, largest number of
+// bytes of it used so far)
+static mp_obj_t stack_info(void) {
+	mp_obj_t t[2] = {
+		MP_OBJ_NEW_SMALL_INT(pythonStackSize),
+		MP_OBJ_NEW_SMALL_INT(pythonStackHighWater()),
+	};
+	return mp_obj_new_tuple(2, t);
+}
+MP_DEFINE_CONST_FUN_OBJ_0(stack_info_obj, stack_info);
+
+// _pew.gc_stats(): garbage collection counts and pause times, see mphal.c
+static mp_obj_t gc_stats(void) {
+	mp_obj_t hist[PD_HAL_GC_HIST_BUCKETS];
+	for (size_t i = 0; i < PD_HAL_GC_HIST_BUCKETS; i++) {
+		hist[i] = mp_obj_new_int_from_uint(pd_hal_gc_stats.hist[i]);
+	}
+	mp_obj_t d = mp_obj_new_dict(5);
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_idle), mp_obj_new_int_from_uint(pd_hal_gc_stats.idle));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_other), mp_obj_new_int_from_uint(pd_hal_gc_stats.other));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_max_us), mp_obj_new_int_from_uint(pd_hal_gc_stats.max_us));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_total_us), mp_obj_new_int_from_uint(pd_hal_gc_stats.total_us));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_hist_ms), mp_obj_new_tuple(PD_HAL_GC_HIST_BUCKETS, hist));
+	return d;
+}
+MP_DEFINE_CONST_FUN_OBJ_0(gc_stats_obj, gc_stats);
+
+// _pew.monotonic(): seconds from the 64-bit microsecond clock, see mphal.c,
+// since startup so that a single-precision float keeps millisecond precision
+// for hours, backs time.monotonic()
+static mp_obj_t monotonic(void) {
+	return mp_obj_new_float((mp_float_t)((pd_hal_ticks_us64() - pd_hal_clock_start_us) / 1000) / 1000);
+}
+MP_DEFINE_CONST_FUN_OBJ_0(monotonic_obj, monotonic);
+
+// _pew.cpu_hz(): frequency of the ticks reported by _pew.bench()
+static mp_obj_t cpu_hz(void) {
+	return mp_obj_new_int_from_uint(pd_hal_cpu_hz());
+}
+MP_DEFINE_CONST_FUN_OBJ_0(cpu_hz_obj, cpu_hz);
+
+static mp_obj_t bench_nop(void) {
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(bench_nop_obj, bench_nop);
+
+static int bench_compare(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// _pew.bench(fn, n): call fn() n times and return the (minimum, median,
+// maximum) time of a call in CPU ticks (cycles on the device, see
+// _pew.cpu_hz()), less the overhead of reading the counter and calling a
+// function that does nothing. Keep fn short: a call that reaches the end of
+// the frame includes the time until the next one.
+static mp_obj_t bench(mp_obj_t fn, mp_obj_t n_in) {
+	mp_int_t n = mp_obj_get_int(n_in);
+	if (n < 1) {
+		mp_raise_ValueError(NULL);
+	}
+	uint32_t *samples = m_new(uint32_t, n);
+	mp_obj_t nop = MP_OBJ_FROM_PTR(&bench_nop_obj);
+	uint32_t overhead = UINT32_MAX;
+	for (mp_int_t i = 0; i < n; i++) {
+		uint32_t start = mp_hal_ticks_cpu();
+		mp_call_function_0(nop);
+		uint32_t t = mp_hal_ticks_cpu() - start;
+		if (t < overhead) {
+			overhead = t;
+		}
+	}
+	for (mp_int_t i = 0; i < n; i++) {
+		uint32_t start = mp_hal_ticks_cpu();
+		mp_call_function_0(fn);
+		uint32_t t = mp_hal_ticks_cpu() - start;
+		samples[i] = (t > overhead) ? t - overhead : 0;
+	}
+	qsort(samples, n, sizeof(samples[0]), bench_compare);
+	mp_obj_t t[3] = {
+		mp_obj_new_int_from_uint(samples[0]),
+		mp_obj_new_int_from_uint(samples[n / 2]),
+		mp_obj_new_int_from_uint(samples[n - 1]),
+	};
+	m_del(uint32_t, samples, n);
+	return mp_obj_new_tuple(3, t);
+}
+MP_DEFINE_CONST_FUN_OBJ_2(bench_obj, bench);
+
+static mp_obj_t frame_stat(FrameStat stat) {
+	FrameStatSummary s;
+	frameStatsSummarize(stat, &s);
+	mp_obj_t t[4] = {
+		mp_obj_new_int_from_uint(s.avg),
+		mp_obj_new_int_from_uint(s.p50),
+		mp_obj_new_int_from_uint(s.p95),
+		mp_obj_new_int_from_uint(s.max),
+	};
+	return mp_obj_new_tuple(4, t);
+}
+
+// _pew.stats(): timings of the recent frames (up to FRAMESTATS_FRAMES) as
+// (average, median, 95th percentile, maximum) in microseconds, and the
+// input-to-photon latency as (count, average, maximum) in milliseconds and a
+// histogram, see framestats.h
+static mp_obj_t stats(void) {
+	mp_obj_t d = mp_obj_new_dict(9);
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_frames), MP_OBJ_NEW_SMALL_INT(frameStatsCount()));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_frame), frame_stat(eFrameStatFrame));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_card), frame_stat(eFrameStatCard));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_python), frame_stat(eFrameStatPython));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_wait), frame_stat(eFrameStatWait));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_gc), frame_stat(eFrameStatGC));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_idle), frame_stat(eFrameStatIdle));
+	mp_obj_t latency[3] = {
+		mp_obj_new_int_from_uint(frameStatsLatency.count),
+		mp_obj_new_int_from_uint(frameStatsLatency.count ? frameStatsLatency.totalMs / frameStatsLatency.count : 0),
+		mp_obj_new_int_from_uint(frameStatsLatency.maxMs),
+	};
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_latency), mp_obj_new_tuple(3, latency));
+	mp_obj_t hist[FRAMESTATS_LATENCY_BUCKETS];
+	for (size_t i = 0; i < FRAMESTATS_LATENCY_BUCKETS; i++) {
+		hist[i] = mp_obj_new_int_from_uint(frameStatsLatency.hist[i]);
+	}
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_latency_hist_ms), mp_obj_new_tuple(FRAMESTATS_LATENCY_BUCKETS, hist));
+	return d;
+}
+MP_DEFINE_CONST_FUN_OBJ_0(stats_obj, stats);
+
+// _pew.trace_dump([path]): write the timeline recorded with PEW_TRACE (see
+// src/trace.h) as Chrome trace_event JSON to the file at path in the data
+// folder, or to stdout, and start over.
+static mp_obj_t trace_dump(size_t n_args, const mp_obj_t *args) {
+	#if PEW_TRACE
+	pew_dump_file_t d;
+	pew_dump_open(&d, (n_args > 0) ? args[0] : MP_OBJ_NULL);
+	traceDump(&d.print);
+	pew_dump_close(&d);
 	return mp_const_none;
+	#else
+	(void)n_args;
+	(void)args;
+	mp_raise_OSError(MP_EOPNOTSUPP);
+	#endif
 }
-MP_DEFINE_CONST_FUN_OBJ_1(tick_obj, tick);
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(trace_dump_obj, 0, 1, trace_dump);
 
 static const mp_rom_map_elem_t pew_module_globals_table[] = {
 	{ MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR__pew) },
 	{ MP_ROM_QSTR(MP_QSTR_show), MP_ROM_PTR(&show_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_keys), MP_ROM_PTR(&keys_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_tick), MP_ROM_PTR(&tick_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_events), MP_ROM_PTR(&pew_events_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_PRESS), MP_ROM_INT(1) },
+	{ MP_ROM_QSTR(MP_QSTR_RELEASE), MP_ROM_INT(2) },
+	{ MP_ROM_QSTR(MP_QSTR_CRANK), MP_ROM_INT(3) },
+	{ MP_ROM_QSTR(MP_QSTR_tick_stats), MP_ROM_PTR(&tick_stats_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_poll), MP_ROM_PTR(&poll_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_set_fps), MP_ROM_PTR(&set_fps_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_TICK_CATCHUP), MP_ROM_INT(PEW_TICK_CATCHUP) },
+	{ MP_ROM_QSTR(MP_QSTR_TICK_SKIP), MP_ROM_INT(PEW_TICK_SKIP) },
+	{ MP_ROM_QSTR(MP_QSTR_TICK_RESET), MP_ROM_INT(PEW_TICK_RESET) },
+	{ MP_ROM_QSTR(MP_QSTR_sync_initfiles), MP_ROM_PTR(&pew_sync_initfiles_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_load_async), MP_ROM_PTR(&pew_load_async_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_save), MP_ROM_PTR(&pew_save_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_load), MP_ROM_PTR(&pew_load_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_save_flush), MP_ROM_PTR(&pew_save_flush_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_heap_info), MP_ROM_PTR(&heap_info_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stack_info), MP_ROM_PTR(&stack_info_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_alloc_profile), MP_ROM_PTR(&pew_alloc_profile_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_alloc_dump), MP_ROM_PTR(&pew_alloc_dump_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_sample_profile), MP_ROM_PTR(&pew_sample_profile_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_sample_dump), MP_ROM_PTR(&pew_sample_dump_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_gc_stats), MP_ROM_PTR(&gc_stats_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&stats_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_trace_dump), MP_ROM_PTR(&trace_dump_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_monotonic), MP_ROM_PTR(&monotonic_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_cpu_hz), MP_ROM_PTR(&cpu_hz_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_bench), MP_ROM_PTR(&bench_obj) },
     { MP_ROM_QSTR(MP_QSTR_VfsPD), MP_ROM_PTR(&mp_type_vfs_pd) },
 };
 static MP_DEFINE_CONST_DICT(pew_module_globals, pew_module_globals_table);
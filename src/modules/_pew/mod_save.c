@@ -0,0 +1,115 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/objstr.h"
+#include "py/mperrno.h"
+
+#include "mod_save.h"
+#include "vfs_pd.h"
+#if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
+#include "src/globals.h"
+#include "src/savestore.h"
+// #else we are in the micropython_embed build which only preprocesses but does
+// not compile, and does not have the Playdate SDK
+#endif
+
+// Save data goes into this directory in the data folder, one file per key.
+#define SAVE_DIR "save/"
+#define SAVE_KEY_MAX 64
+
+static void pew_save_path(char *path, mp_obj_t key_in) {
+	size_t len;
+	const char *key = mp_obj_str_get_data(key_in, &len);
+	size_t suffix = sizeof(SAVESTORE_TMP_SUFFIX) - 1;
+	if (len == 0 || len > SAVE_KEY_MAX || key[0] == '.'
+		// would collide with the temporary file of another key
+		|| (len >= suffix && memcmp(key + len - suffix, SAVESTORE_TMP_SUFFIX, suffix) == 0))
+	{
+		mp_raise_ValueError(MP_ERROR_TEXT("invalid key"));
+	}
+	// not allowed in file names on the FAT file system of the device
+	for (size_t i = 0; i < len; i++) {
+		if ((unsigned char)key[i] < 0x20 || strchr("/\\:*?\"<>|", key[i]) != NULL) {
+			mp_raise_ValueError(MP_ERROR_TEXT("invalid key"));
+		}
+	}
+	memcpy(path, SAVE_DIR, sizeof(SAVE_DIR) - 1);
+	memcpy(path + sizeof(SAVE_DIR) - 1, key, len);
+	path[sizeof(SAVE_DIR) - 1 + len] = '\0';
+}
+
+// _pew.save(key, data): store data (bytes or any other buffer) under key. It
+// is only copied here and written out later when a frame has time to spare,
+// or at the latest when the device is locked or the game exits, so this can
+// be called every frame. Whatever is on the card is replaced atomically.
+static mp_obj_t pew_save(mp_obj_t key_in, mp_obj_t data_in) {
+	char path[sizeof(SAVE_DIR) + SAVE_KEY_MAX];
+	pew_save_path(path, key_in);
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(data_in, &bufinfo, MP_BUFFER_READ);
+	if (saveStorePut(global_pd, path, bufinfo.buf, bufinfo.len) != 0) {
+		mp_raise_OSError(MP_ENOMEM);
+	}
+	return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_2(pew_save_obj, pew_save);
+
+// _pew.load(key): the data last saved under key as bytes, including any that
+// has not been written yet, or None if there is none.
+static mp_obj_t pew_load(mp_obj_t key_in) {
+	char path[sizeof(SAVE_DIR) + SAVE_KEY_MAX];
+	pew_save_path(path, key_in);
+	int len;
+	const void *data = saveStorePending(path, &len);
+	if (data != NULL) {
+		return mp_obj_new_bytes(data, len);
+	}
+	FileStat st;
+	if (global_pd->file->stat(path, &st) != 0) {
+		return mp_const_none;
+	}
+	SDFile *f = global_pd->file->open(path, kFileReadData);
+	if (f == NULL) {
+		return mp_const_none;
+	}
+	vstr_t vstr;
+	vstr_init_len(&vstr, st.size);
+	int res = (st.size > 0) ? global_pd->file->read(f, vstr.buf, st.size) : 0;
+	global_pd->file->close(f);
+	if (res < 0) {
+		vstr_clear(&vstr);
+		raise_OSError_pd();
+	}
+	vstr.len = res;
+	return mp_obj_new_bytes_from_vstr(&vstr);
+}
+MP_DEFINE_CONST_FUN_OBJ_1(pew_load_obj, pew_load);
+
+// _pew.save_flush(): write out everything saved so far right away.
+static mp_obj_t pew_save_flush(void) {
+	saveStoreFlushAll(global_pd);
+	return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_0(pew_save_flush_obj, pew_save_flush);
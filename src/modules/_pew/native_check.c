@@ -0,0 +1,192 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "py/runtime.h"
+#include "py/compile.h"
+#include "py/parse.h"
+#include "py/objexcept.h"
+
+// Code compiled by the native and viper emitters does not run the VM hooks, so
+// a long loop in it would never yield to update() (see MICROPY_VM_HOOK_POLL),
+// freezing the game until the system gives up on it. The emitters are part of
+// MicroPython, so rather than changing what they emit, compiling is wrapped at
+// link time (device only, see the Makefile) to refuse @micropython.native and
+// @micropython.viper functions with a loop that doesn't mention poll (as in
+// _pew.poll()) or tick (as in pew.tick()). Loops over range() with small
+// constant arguments are bounded and exempt.
+
+// The micropython_embed build, which has neither TARGET_ defined, gets it for
+// the qstrs.
+#if (defined(TARGET_PLAYDATE) || !defined(TARGET_SIMULATOR)) && MICROPY_EMIT_NATIVE
+
+// larger constant range() arguments than this need a poll
+#define NATIVE_CHECK_MAX_RANGE 1024
+
+// rule ids, as in compile.c
+typedef enum {
+	#define DEF_RULE(rule, comp, kind, ...) PN_##rule,
+	#define DEF_RULE_NC(rule, kind, ...)
+	#include "py/grammar.h"
+	#undef DEF_RULE
+	#undef DEF_RULE_NC
+	PN_const_object,
+	#define DEF_RULE(rule, comp, kind, ...)
+	#define DEF_RULE_NC(rule, kind, ...) PN_##rule,
+	#include "py/grammar.h"
+	#undef DEF_RULE
+	#undef DEF_RULE_NC
+} native_check_pn_kind_t;
+
+static bool native_check_mentions_poll(mp_parse_node_t pn) {
+	if (MP_PARSE_NODE_IS_ID(pn)) {
+		qstr q = MP_PARSE_NODE_LEAF_ARG(pn);
+		return q == MP_QSTR_poll || q == MP_QSTR_tick;
+	}
+	if (!MP_PARSE_NODE_IS_STRUCT(pn)) {
+		return false;
+	}
+	mp_parse_node_struct_t *pns = (mp_parse_node_struct_t *)pn;
+	size_t n = MP_PARSE_NODE_STRUCT_NUM_NODES(pns);
+	for (size_t i = 0; i < n; i++) {
+		if (native_check_mentions_poll(pns->nodes[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool native_check_is_small_int(mp_parse_node_t pn) {
+	if (!MP_PARSE_NODE_IS_SMALL_INT(pn)) {
+		return false;
+	}
+	mp_int_t v = MP_PARSE_NODE_LEAF_SMALL_INT(pn);
+	return v >= -NATIVE_CHECK_MAX_RANGE && v <= NATIVE_CHECK_MAX_RANGE;
+}
+
+// for x in range(<small int literals>)
+static bool native_check_is_small_range(mp_parse_node_struct_t *pns_for) {
+	mp_parse_node_t iter = pns_for->nodes[1];
+	if (!MP_PARSE_NODE_IS_STRUCT_KIND(iter, PN_atom_expr_normal)) {
+		return false;
+	}
+	mp_parse_node_struct_t *pns = (mp_parse_node_struct_t *)iter;
+	if (!MP_PARSE_NODE_IS_ID(pns->nodes[0]) || MP_PARSE_NODE_LEAF_ARG(pns->nodes[0]) != MP_QSTR_range
+		|| !MP_PARSE_NODE_IS_STRUCT_KIND(pns->nodes[1], PN_trailer_paren))
+	{
+		return false;
+	}
+	mp_parse_node_struct_t *pns_paren = (mp_parse_node_struct_t *)pns->nodes[1];
+	mp_parse_node_t *args;
+	size_t n = mp_parse_node_extract_list(&pns_paren->nodes[0], PN_arglist, &args);
+	if (n == 0) {
+		return false;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (!native_check_is_small_int(args[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void native_check_loops(mp_parse_node_t pn, qstr source_file) {
+	if (!MP_PARSE_NODE_IS_STRUCT(pn)) {
+		return;
+	}
+	mp_parse_node_struct_t *pns = (mp_parse_node_struct_t *)pn;
+	size_t kind = MP_PARSE_NODE_STRUCT_KIND(pns);
+	if ((kind == PN_while_stmt || (kind == PN_for_stmt && !native_check_is_small_range(pns)))
+		&& !native_check_mentions_poll(pn))
+	{
+		mp_obj_t exc = mp_obj_new_exception_msg(&mp_type_SyntaxError, MP_ERROR_TEXT("native loop must call _pew.poll()"));
+		mp_obj_exception_add_traceback(exc, source_file, pns->source_line, MP_QSTRnull);
+		nlr_raise(exc);
+	}
+	size_t n = MP_PARSE_NODE_STRUCT_NUM_NODES(pns);
+	for (size_t i = 0; i < n; i++) {
+		native_check_loops(pns->nodes[i], source_file);
+	}
+}
+
+static bool native_check_is_native_decorator(mp_parse_node_t pn) {
+	if (!MP_PARSE_NODE_IS_STRUCT_KIND(pn, PN_decorator)) {
+		return false;
+	}
+	mp_parse_node_t *name_nodes;
+	size_t name_len = mp_parse_node_extract_list(&((mp_parse_node_struct_t *)pn)->nodes[0], PN_dotted_name, &name_nodes);
+	if (name_len != 2 || !MP_PARSE_NODE_IS_ID(name_nodes[0]) || MP_PARSE_NODE_LEAF_ARG(name_nodes[0]) != MP_QSTR_micropython
+		|| !MP_PARSE_NODE_IS_ID(name_nodes[1]))
+	{
+		return false;
+	}
+	qstr attr = MP_PARSE_NODE_LEAF_ARG(name_nodes[1]);
+	return attr == MP_QSTR_native || attr == MP_QSTR_viper;
+}
+
+static void native_check(mp_parse_node_t pn, qstr source_file) {
+	if (!MP_PARSE_NODE_IS_STRUCT(pn)) {
+		return;
+	}
+	mp_parse_node_struct_t *pns = (mp_parse_node_struct_t *)pn;
+	if (MP_PARSE_NODE_STRUCT_KIND(pns) == PN_decorated) {
+		mp_parse_node_t *decorators;
+		size_t n = mp_parse_node_extract_list(&pns->nodes[0], PN_decorators, &decorators);
+		for (size_t i = 0; i < n; i++) {
+			if (native_check_is_native_decorator(decorators[i])) {
+				native_check_loops(pns->nodes[1], source_file);
+				return;
+			}
+		}
+	}
+	size_t n = MP_PARSE_NODE_STRUCT_NUM_NODES(pns);
+	for (size_t i = 0; i < n; i++) {
+		native_check(pns->nodes[i], source_file);
+	}
+}
+
+static void native_check_tree(mp_parse_tree_t *parse_tree, qstr source_file) {
+	nlr_buf_t nlr;
+	if (nlr_push(&nlr) == 0) {
+		native_check(parse_tree->root, source_file);
+		nlr_pop();
+	}
+	else {
+		// the compiler would have freed it
+		mp_parse_tree_clear(parse_tree);
+		nlr_jump(nlr.ret_val);
+	}
+}
+
+mp_obj_t __real_mp_compile(mp_parse_tree_t *parse_tree, qstr source_file, bool is_repl);
+void __real_mp_compile_to_raw_code(mp_parse_tree_t *parse_tree, qstr source_file, bool is_repl, mp_compiled_module_t *cm);
+
+mp_obj_t __wrap_mp_compile(mp_parse_tree_t *parse_tree, qstr source_file, bool is_repl) {
+	native_check_tree(parse_tree, source_file);
+	return __real_mp_compile(parse_tree, source_file, is_repl);
+}
+
+void __wrap_mp_compile_to_raw_code(mp_parse_tree_t *parse_tree, qstr source_file, bool is_repl, mp_compiled_module_t *cm) {
+	native_check_tree(parse_tree, source_file);
+	__real_mp_compile_to_raw_code(parse_tree, source_file, is_repl, cm);
+}
+
+#endif
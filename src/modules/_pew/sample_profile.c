@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "py/mperrno.h"
+
+#include "sample_profile.h"
+#include "alloc_profile.h"
+#include "dump_file.h"
+#if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
+#include "src/globals.h"
+// #else we are in the micropython_embed build which only preprocesses but does
+// not compile, and does not have the Playdate SDK
+#endif
+
+// Sampling profiler: while enabled, MICROPY_VM_HOOK_LOOP and
+// MICROPY_VM_HOOK_RETURN look at the clock every SAMPLE_PROFILE_CHECK
+// branches, and once per interval record the source position of the running
+// bytecode into a ring buffer. The VM does not link code states to their
+// callers (unless sys.settrace is enabled, which is too costly), so each
+// sample is just the innermost function and line. Time spent outside of
+// Python (between frames, waiting) is not sampled: a sample that is overdue
+// by more than an interval is skipped.
+
+#define SAMPLE_PROFILE_SAMPLES 2048
+#define SAMPLE_PROFILE_CHECK 8
+
+typedef struct {
+	qstr file;
+	qstr block;
+	uint32_t line;
+} sample_t;
+
+// checked by MICROPY_VM_HOOK_LOOP and MICROPY_VM_HOOK_RETURN
+int pew_sample_profile_enabled = 0;
+
+// in the C heap so that the profiler doesn't disturb the GC heap
+static sample_t *samples = NULL;
+// total number of samples taken, the ring holds the last
+// SAMPLE_PROFILE_SAMPLES of them
+static uint32_t sample_count;
+static uint32_t sample_interval_us;
+static mp_uint_t sample_due;
+static int sample_check_divisor;
+
+void pew_sample_profile_tick(void *code_state, const byte *ip) {
+	if (--sample_check_divisor > 0) {
+		return;
+	}
+	sample_check_divisor = SAMPLE_PROFILE_CHECK;
+	mp_uint_t now = mp_hal_ticks_us();
+	mp_int_t late = (mp_int_t)(now - sample_due);
+	if (late < 0) {
+		return;
+	}
+	sample_due = now + sample_interval_us;
+	if (late > (mp_int_t)sample_interval_us) {
+		// we were not running Python in the meantime
+		return;
+	}
+	sample_t *s = &samples[sample_count++ % SAMPLE_PROFILE_SAMPLES];
+	size_t line;
+	pew_vm_source_site(code_state, ip, &s->file, &s->block, &line);
+	s->line = line;
+}
+
+// _pew.sample_profile(interval_us): start sampling from scratch every
+// interval_us microseconds of Python execution, or stop if 0
+static mp_obj_t pew_sample_profile(mp_obj_t interval_in) {
+	mp_int_t interval = mp_obj_get_int(interval_in);
+	if (interval < 0) {
+		mp_raise_ValueError(NULL);
+	}
+	if (interval > 0) {
+		if (samples == NULL) {
+			samples = global_pd->system->realloc(NULL, SAMPLE_PROFILE_SAMPLES * sizeof(sample_t));
+			if (samples == NULL) {
+				mp_raise_OSError(MP_ENOMEM);
+			}
+		}
+		sample_count = 0;
+		sample_interval_us = interval;
+		sample_due = mp_hal_ticks_us() + sample_interval_us;
+		sample_check_divisor = SAMPLE_PROFILE_CHECK;
+		pew_sample_profile_enabled = 1;
+	}
+	else {
+		pew_sample_profile_enabled = 0;
+	}
+	return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_1(pew_sample_profile_obj, pew_sample_profile);
+
+static int sample_compare(const void *a, const void *b) {
+	const sample_t *sa = a;
+	const sample_t *sb = b;
+	if (sa->file != sb->file) {
+		return (sa->file < sb->file) ? -1 : 1;
+	}
+	if (sa->block != sb->block) {
+		return (sa->block < sb->block) ? -1 : 1;
+	}
+	if (sa->line != sb->line) {
+		return (sa->line < sb->line) ? -1 : 1;
+	}
+	return 0;
+}
+
+// _pew.sample_dump([path]): write the number of samples per source line to
+// the file at path in the data folder, or to stdout, and start over. See
+// profreport.py for the format and for turning it into flame graph input.
+static mp_obj_t pew_sample_dump(size_t n_args, const mp_obj_t *args) {
+	pew_dump_file_t d;
+	pew_dump_open(&d, (n_args > 0) ? args[0] : MP_OBJ_NULL);
+	const mp_print_t *print = &d.print;
+	// Don't sample our own sorting and writing.
+	int enabled = pew_sample_profile_enabled;
+	pew_sample_profile_enabled = 0;
+	// Nothing in here allocates from the GC heap, so the file is always closed.
+	mp_printf(print, "pewpew-samples 1\n");
+	mp_printf(print, "interval %u\n", (unsigned int)sample_interval_us);
+	mp_printf(print, "total %u\n", (unsigned int)sample_count);
+	if (samples != NULL) {
+		size_t n = (sample_count < SAMPLE_PROFILE_SAMPLES) ? sample_count : SAMPLE_PROFILE_SAMPLES;
+		// order doesn't matter any more, fold equal samples together
+		qsort(samples, n, sizeof(sample_t), sample_compare);
+		for (size_t i = 0; i < n; ) {
+			size_t j = i + 1;
+			while (j < n && sample_compare(&samples[i], &samples[j]) == 0) {
+				j++;
+			}
+			mp_printf(print, "sample %u %s:%u %s\n", (unsigned int)(j - i), pew_dump_qstr(samples[i].file), (unsigned int)samples[i].line, pew_dump_qstr(samples[i].block));
+			i = j;
+		}
+	}
+	sample_count = 0;
+	sample_due = mp_hal_ticks_us() + sample_interval_us;
+	pew_sample_profile_enabled = enabled;
+	pew_dump_close(&d);
+	return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(pew_sample_dump_obj, 0, 1, pew_sample_dump);
@@ -20,6 +20,8 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include <string.h>
+
 #include "py/runtime.h"
 #include "py/mperrno.h"
 #include "extmod/vfs.h"
@@ -32,68 +34,68 @@ THE SOFTWARE.
 // not compile, and does not have the Playdate SDK
 #endif
 
+// Bumped by every modification through any VfsPD, invalidates all directory
+// caches. Several mounts may refer to the same directories.
+static uint32_t vfs_pd_generation = 1;
+
+vfs_pd_stats_t vfs_pd_stats;
+
+// Append the components of path[0..len] to self->root, each followed by a /,
+// resolving . and .. on the way.
+static void vfs_pd_append_normalized(mp_obj_vfs_pd_t *self, const char *path, size_t len) {
+	const char *end = path + len;
+	while (path < end) {
+		const char *next = memchr(path, '/', end - path);
+		if (next == NULL) {
+			next = end;
+		}
+		size_t n = next - path;
+		if (n == 0 || (n == 1 && path[0] == '.')) {
+			// empty or '.', ignore
+		}
+		else if (n == 2 && path[0] == '.' && path[1] == '.') {
+			// '..', skip back, but only if not at the tip
+			size_t to = self->root.len;
+			if (to > self->root_len) {
+				for (--to; to > self->root_len && self->root.buf[to - 1] != '/'; --to) {
+					// Skip back
+				}
+			}
+			self->root.len = to;
+		}
+		else {
+			vstr_add_strn(&self->root, path, n);
+			vstr_add_byte(&self->root, '/');
+		}
+		path = next + 1;
+	}
+}
+
 // input: path relative to root if starting with '/', else relative to cur_dir
 // output: full path ready for Playdate APIs, no leading or trailing /, no . or ..
-const char *vfs_pd_make_path(mp_obj_vfs_pd_t *self, mp_obj_t path_in) {
-	const char *path = mp_obj_str_get_str(path_in);
+// The result lives in self->root and is only valid until the next call.
+const char *vfs_pd_make_path_str(mp_obj_vfs_pd_t *self, const char *path) {
 	self->root.len = self->root_len;
 	// the previous call may have eaten up the trailing / if it referred to the
 	// root, put it back
 	if (self->root_len > 0) {
 		self->root.buf[self->root_len-1] = '/';
 	}
-	if (path[0] == '/') {
-		path += 1;
+	if (path[0] != '/') {
+		vfs_pd_append_normalized(self, vstr_str(&self->cur_dir), vstr_len(&self->cur_dir));
 	}
-	else {
-		vstr_add_strn(&self->root, vstr_str(&self->cur_dir)+1, vstr_len(&self->cur_dir)-1);
-	}
-	vstr_add_str(&self->root, path);
-
-	// normalize
-	// add a slash so that every component is slash-terminated
-	vstr_add_byte(&self->root, '/');
-	#define PATH_LEN (vstr_len(&self->root))
-	size_t to = 0;
-	size_t from = 0;
-	char *cwd = vstr_str(&self->root);
-	while (from < PATH_LEN) {
-		for (; from < PATH_LEN && cwd[from] == '/'; ++from) {
-			// Scan for the start
-		}
-		if (from > to) {
-			// Found excessive slash chars, squeeze them out
-			vstr_cut_out_bytes(&self->root, to, from - to);
-			from = to;
-		}
-		for (; from < PATH_LEN && cwd[from] != '/'; ++from) {
-			// Scan for the next /
-		}
-		if ((from - to) == 1 && cwd[to] == '.') {
-			// './', ignore
-			vstr_cut_out_bytes(&self->root, to, ++from - to);
-			from = to;
-		} else if ((from - to) == 2 && cwd[to] == '.' && cwd[to + 1] == '.') {
-			// '../', skip back
-			if (to > self->root_len) {
-				// Only skip back if not at the tip
-				for (--to; to > self->root_len && cwd[to - 1] != '/'; --to) {
-					// Skip back
-				}
-			}
-			vstr_cut_out_bytes(&self->root, to, ++from - to);
-			from = to;
-		} else {
-			// Normal element, keep it and just move the offset
-			to = ++from;
-		}
+	vfs_pd_append_normalized(self, path, strlen(path));
+	// every component is slash-terminated, remove the terminating / of the last
+	if (self->root.len > 0) {
+		self->root.len--;
 	}
-	// if there are more than 0 components, remove the terminating / of the last
-	vstr_cut_tail_bytes(&self->root, 1);
-
 	return vstr_null_terminated_str(&self->root);
 }
 
+const char *vfs_pd_make_path(mp_obj_vfs_pd_t *self, mp_obj_t path_in) {
+	return vfs_pd_make_path_str(self, mp_obj_str_get_str(path_in));
+}
+
 NORETURN void raise_OSError_pd(void) {
 	const char* msg = global_pd->file->geterr();
 	mp_obj_t o_str = mp_obj_new_str_from_cstr(msg);
@@ -103,30 +105,182 @@ NORETURN void raise_OSError_pd(void) {
 	nlr_raise(mp_obj_exception_make_new(&mp_type_OSError, 2, 0, args));
 }
 
+void vfs_pd_cache_invalidate(void) {
+	vfs_pd_generation++;
+}
+
+static void vfs_pd_dircache_callback(const char* filename, void* userdata) {
+	vfs_pd_dircache_t *entry = userdata;
+	if (entry->complete) {
+		size_t len = strlen(filename) + 1;
+		if (entry->data.len + len > VFS_PD_DIRCACHE_MAX_BYTES) {
+			entry->complete = false;
+		}
+		else {
+			vstr_add_strn(&entry->data, filename, len);
+		}
+	}
+}
+
+// Compare file names as the file system does: the device's is FAT, which
+// ignores the case of ASCII letters, the simulator uses the host's and is
+// taken to be case-sensitive, which errs on the side of asking the SDK.
+static bool vfs_pd_name_equal(const char *a, const char *b, size_t len) {
+	#if defined(TARGET_PLAYDATE)
+	for (size_t i = 0; i < len; i++) {
+		if (unichar_tolower(a[i]) != unichar_tolower(b[i])) {
+			return false;
+		}
+	}
+	return true;
+	#else
+	return memcmp(a, b, len) == 0;
+	#endif
+}
+
+// Look up the directory part of path (a result of vfs_pd_make_path that ends
+// dirlen bytes in) in the cache, listing it if necessary.
+static vfs_pd_dircache_t *vfs_pd_dircache_get(mp_obj_vfs_pd_t *self, char *path, size_t dirlen) {
+	for (size_t i = 0; i < VFS_PD_DIRCACHE_ENTRIES; i++) {
+		vfs_pd_dircache_t *entry = &self->dircache[i];
+		if (entry->generation == vfs_pd_generation
+			&& entry->data.len > dirlen
+			&& vfs_pd_name_equal(entry->data.buf, path, dirlen)
+			&& entry->data.buf[dirlen] == '\0')
+		{
+			vfs_pd_stats.cache_hits++;
+			return entry;
+		}
+	}
+
+	vfs_pd_dircache_t *entry = &self->dircache[self->dircache_next];
+	self->dircache_next = (self->dircache_next + 1) % VFS_PD_DIRCACHE_ENTRIES;
+	// invalid until complete, in case the callback raises MemoryError
+	entry->generation = 0;
+	vstr_reset(&entry->data);
+	vstr_add_strn(&entry->data, path, dirlen);
+	vstr_add_byte(&entry->data, '\0');
+	entry->complete = true;
+	// temporarily terminate the path at the directory
+	char c = path[dirlen];
+	path[dirlen] = '\0';
+	vfs_pd_stats.listfiles++;
+	entry->exists = (global_pd->file->listfiles(path, &vfs_pd_dircache_callback, entry, true) == 0);
+	path[dirlen] = c;
+	entry->generation = vfs_pd_generation;
+	return entry;
+}
+
+// Like stat, but only tells whether path (a result of vfs_pd_make_path) is a
+// file, a directory, or doesn't exist, answering from the directory cache
+// where possible.
+mp_import_stat_t vfs_pd_cached_stat(mp_obj_vfs_pd_t *self, char *path) {
+	size_t len = strlen(path);
+	if (len == 0 || len + 1 == self->root_len) {
+		// the root of the mount, assume it exists
+		return MP_IMPORT_STAT_DIR;
+	}
+	char *slash = strrchr(path, '/');
+	size_t dirlen = (slash == NULL) ? 0 : slash - path;
+	const char *name = (slash == NULL) ? path : slash + 1;
+	vfs_pd_dircache_t *entry = vfs_pd_dircache_get(self, path, dirlen);
+	if (!entry->exists) {
+		return MP_IMPORT_STAT_NO_EXIST;
+	}
+	if (!entry->complete) {
+		// too large to cache, ask the SDK
+		FileStat st;
+		vfs_pd_stats.stat++;
+		if (global_pd->file->stat(path, &st) == 0) {
+			return st.isdir ? MP_IMPORT_STAT_DIR : MP_IMPORT_STAT_FILE;
+		}
+		return MP_IMPORT_STAT_NO_EXIST;
+	}
+	size_t namelen = strlen(name);
+	const char *p = entry->data.buf + dirlen + 1;
+	const char *end = entry->data.buf + entry->data.len;
+	while (p < end) {
+		size_t n = strlen(p);
+		if (n >= namelen && vfs_pd_name_equal(p, name, namelen)) {
+			if (n == namelen) {
+				return MP_IMPORT_STAT_FILE;
+			}
+			if (n == namelen + 1 && p[namelen] == '/') {
+				return MP_IMPORT_STAT_DIR;
+			}
+		}
+		p += n + 1;
+	}
+	return MP_IMPORT_STAT_NO_EXIST;
+}
+
+// Whether the full path from vfs_pd_make_path names one of self->shadowed.
+static bool vfs_pd_is_shadowed(mp_obj_vfs_pd_t *self) {
+	if (self->shadowed == mp_const_none) {
+		return false;
+	}
+	const char *name = self->root.buf + self->root_len;
+	size_t len = self->root.len - self->root_len;
+	if (self->root.len < self->root_len || memchr(name, '/', len) != NULL) {
+		return false;
+	}
+	size_t n;
+	mp_obj_t *items;
+	mp_obj_get_array(self->shadowed, &n, &items);
+	for (size_t i = 0; i < n; i++) {
+		size_t l;
+		const char *s = mp_obj_str_get_data(items[i], &l);
+		if (l == len && memcmp(s, name, len) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
 static mp_import_stat_t mp_vfs_pd_import_stat(void *self_in, const char *path) {
 	mp_obj_vfs_pd_t *self = self_in;
-	if (self->root_len != 0) {
-		self->root.len = self->root_len;
-		if (self->root_len > 0) {
-			self->root.buf[self->root_len-1] = '/';
+	vfs_pd_stats.import_stat++;
+	mp_import_stat_t stat = vfs_pd_cached_stat(self, (char *)vfs_pd_make_path_str(self, path));
+	if (stat == MP_IMPORT_STAT_FILE && vfs_pd_is_shadowed(self)) {
+		stat = MP_IMPORT_STAT_NO_EXIST;
+		// a pristine .mpy next to an edited .py still stands for the cached
+		// compilation of the .py, which takes precedence over the ROM
+		if (self->mpycache) {
+			vfs_pd_mpycache_import_stat(self, path, &stat);
 		}
-		vstr_add_str(&self->root, path);
-		path = vstr_null_terminated_str(&self->root);
+		return stat;
 	}
-	FileStat st;
-	if (global_pd->file->stat(path, &st) == 0) {
-		return st.isdir ? MP_IMPORT_STAT_DIR : MP_IMPORT_STAT_FILE;
+	if (self->mpycache && vfs_pd_mpycache_import_stat(self, path, &stat)) {
+		return stat;
 	}
-	return MP_IMPORT_STAT_NO_EXIST;
+	if (stat == MP_IMPORT_STAT_NO_EXIST) {
+		// a compressed variant is just as good, vfs_pd_open will decompress it
+		vstr_add_str(&self->root, VFS_PD_COMPRESSED_SUFFIX);
+		if (vfs_pd_cached_stat(self, (char *)vstr_null_terminated_str(&self->root)) == MP_IMPORT_STAT_FILE) {
+			stat = MP_IMPORT_STAT_FILE;
+		}
+	}
+	return stat;
 }
 
-static mp_obj_t vfs_pd_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
-	mp_arg_check_num(n_args, n_kw, 0, 1, false);
+static mp_obj_t vfs_pd_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+	enum { ARG_root, ARG_bufsize, ARG_mpycache, ARG_shadowed };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_root, MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+		{ MP_QSTR_bufsize, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = VFS_PD_DEFAULT_BUFSIZE} },
+		{ MP_QSTR_mpycache, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false} },
+		{ MP_QSTR_shadowed, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+	};
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+	if (args[ARG_bufsize].u_int < 0) {
+		mp_raise_ValueError(NULL);
+	}
 
 	mp_obj_vfs_pd_t *vfs = mp_obj_malloc(mp_obj_vfs_pd_t, type);
 	vstr_init(&vfs->root, 0);
-	if (n_args == 1) {
-		const char *root = mp_obj_str_get_str(args[0]);
+	if (args[ARG_root].u_obj != mp_const_none) {
+		const char *root = mp_obj_str_get_str(args[ARG_root].u_obj);
 		while (root[0] == '/') {
 			root++;
 		}
@@ -136,9 +290,19 @@ static mp_obj_t vfs_pd_make_new(const mp_obj_type_t *type, size_t n_args, size_t
 		}
 	}
 	vfs->root_len = vfs->root.len;
+	for (size_t i = 0; i < VFS_PD_DIRCACHE_ENTRIES; i++) {
+		vstr_init(&vfs->dircache[i].data, 0);
+		vfs->dircache[i].generation = 0;
+	}
+	vfs->dircache_next = 0;
 	vstr_init(&vfs->cur_dir, 1);
 	vstr_add_byte(&vfs->cur_dir, '/');
+	vfs->bufsize = args[ARG_bufsize].u_int;
 	vfs->readonly = false;
+	vfs->mpycache = args[ARG_mpycache].u_bool;
+	vstr_init(&vfs->mpy_from, 0);
+	vstr_init(&vfs->mpy_to, 0);
+	vfs->shadowed = args[ARG_shadowed].u_obj;
 
 	return MP_OBJ_FROM_PTR(vfs);
 }
@@ -162,19 +326,15 @@ static mp_obj_t vfs_pd_umount(mp_obj_t self_in) {
 static MP_DEFINE_CONST_FUN_OBJ_1(vfs_pd_umount_obj, vfs_pd_umount);
 
 // vfs_pd_open implemented in vfs_pd_file.c
-static MP_DEFINE_CONST_FUN_OBJ_3(vfs_pd_open_obj, vfs_pd_open);
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(vfs_pd_open_obj, 3, 4, vfs_pd_open);
 
 static mp_obj_t vfs_pd_chdir(mp_obj_t self_in, mp_obj_t path_in) {
 	mp_obj_vfs_pd_t *self = MP_OBJ_TO_PTR(self_in);
 
 	// Check path exists
 	const char *path = vfs_pd_make_path(self, path_in);
-	if (path[0] != '\0') {
-		// Not at root, check it exists
-		FileStat st;
-		if (global_pd->file->stat(path, &st) < 0 || !st.isdir) {
-			mp_raise_OSError(MP_ENOENT);
-		}
+	if (vfs_pd_cached_stat(self, (char *)path) != MP_IMPORT_STAT_DIR) {
+		mp_raise_OSError(MP_ENOENT);
 	}
 
 	// Update cur_dir with new path
@@ -198,43 +358,116 @@ static mp_obj_t vfs_pd_getcwd(mp_obj_t self_in) {
 }
 static MP_DEFINE_CONST_FUN_OBJ_1(vfs_pd_getcwd_obj, vfs_pd_getcwd);
 
-typedef struct {
-	mp_obj_t list;
+static mp_uint_t vfs_pd_mtime(const FileStat *st) {
+	return timeutils_seconds_since_2000(st->m_year, st->m_month, st->m_day, st->m_hour, st->m_minute, st->m_second);
+}
+
+// Iterator for ilistdir: listfiles is run to completion up front because it
+// only offers a callback interface, but it only collects the names into a
+// compact arena, the tuples are created one at a time as they are requested.
+typedef struct _vfs_pd_ilistdir_it_t {
+	mp_obj_base_t base;
+	mp_fun_1_t iternext;
+	// each name NUL-terminated, directories with a trailing '/'
+	vstr_t names;
+	size_t pos;
+	// if with_stat: the directory with a trailing '/', to be completed with
+	// each name for stat
+	vstr_t path;
+	size_t dirlen;
 	bool is_str;
-} vfs_pd_ilistdir_userdata_t;
+	bool with_stat;
+} vfs_pd_ilistdir_it_t;
 
 static void vfs_pd_ilistdir_callback(const char* filename, void* userdata) {
-	mp_obj_tuple_t *t = MP_OBJ_TO_PTR(mp_obj_new_tuple(3, NULL));
-	int isdir = (strchr(filename, '/') != NULL);
-	if (((vfs_pd_ilistdir_userdata_t*)userdata)->is_str) {
-		t->items[0] = mp_obj_new_str(filename, strlen(filename) - isdir);
+	vstr_add_strn((vstr_t*)userdata, filename, strlen(filename) + 1);
+}
+
+static mp_obj_t vfs_pd_ilistdir_it_iternext(mp_obj_t self_in) {
+	vfs_pd_ilistdir_it_t *self = MP_OBJ_TO_PTR(self_in);
+	if (self->pos >= self->names.len) {
+		// release the arena early, the iterator may be kept around
+		vstr_clear(&self->names);
+		vstr_clear(&self->path);
+		self->names.len = 0;
+		self->pos = 0;
+		return MP_OBJ_STOP_ITERATION;
+	}
+	const char *filename = self->names.buf + self->pos;
+	size_t len = strlen(filename);
+	self->pos += len + 1;
+	int isdir = (len > 0 && filename[len - 1] == '/');
+	mp_obj_tuple_t *t = MP_OBJ_TO_PTR(mp_obj_new_tuple(self->with_stat ? 4 : 3, NULL));
+	if (self->is_str) {
+		t->items[0] = mp_obj_new_str(filename, len - isdir);
 	}
 	else {
-		t->items[0] = mp_obj_new_bytes((const byte *)filename, strlen(filename) - isdir);
+		t->items[0] = mp_obj_new_bytes((const byte *)filename, len - isdir);
 	}
 	t->items[1] = MP_OBJ_NEW_SMALL_INT(isdir ? MP_S_IFDIR : MP_S_IFREG);
-	t->items[2] = MP_OBJ_NEW_SMALL_INT(0); // no inode number
-	mp_obj_list_append(((vfs_pd_ilistdir_userdata_t*)userdata)->list, MP_OBJ_FROM_PTR(t));
+	if (self->with_stat) {
+		self->path.len = self->dirlen;
+		vstr_add_strn(&self->path, filename, len - isdir);
+		FileStat st;
+		vfs_pd_stats.stat++;
+		if (global_pd->file->stat(vstr_null_terminated_str(&self->path), &st) == 0) {
+			t->items[2] = mp_obj_new_int_from_uint(st.size);
+			t->items[3] = mp_obj_new_int_from_uint(vfs_pd_mtime(&st));
+		}
+		else {
+			t->items[2] = MP_OBJ_NEW_SMALL_INT(0);
+			t->items[3] = MP_OBJ_NEW_SMALL_INT(0);
+		}
+	}
+	else {
+		t->items[2] = MP_OBJ_NEW_SMALL_INT(0); // no inode number
+	}
+	return MP_OBJ_FROM_PTR(t);
 }
 
-static mp_obj_t vfs_pd_ilistdir(mp_obj_t self_in, mp_obj_t path_in) {
+static mp_obj_t vfs_pd_ilistdir_common(mp_obj_t self_in, mp_obj_t path_in, bool with_stat) {
 	mp_obj_vfs_pd_t *self = MP_OBJ_TO_PTR(self_in);
-	vfs_pd_ilistdir_userdata_t ud;
-	ud.list = mp_obj_new_list(0, NULL);
-	ud.is_str = (mp_obj_get_type(path_in) == &mp_type_str);
-	if (global_pd->file->listfiles(vfs_pd_make_path(self, path_in), &vfs_pd_ilistdir_callback, &ud, true) < 0) {
+	vfs_pd_ilistdir_it_t *iter = mp_obj_malloc(vfs_pd_ilistdir_it_t, &mp_type_polymorph_iter);
+	iter->iternext = vfs_pd_ilistdir_it_iternext;
+	iter->pos = 0;
+	iter->is_str = (mp_obj_get_type(path_in) == &mp_type_str);
+	iter->with_stat = with_stat;
+	vstr_init(&iter->names, 64);
+	vstr_init(&iter->path, 0);
+	const char *path = vfs_pd_make_path(self, path_in);
+	vfs_pd_stats.listfiles++;
+	if (global_pd->file->listfiles(path, &vfs_pd_ilistdir_callback, &iter->names, true) < 0) {
 		raise_OSError_pd();
 	}
-	return mp_getiter(ud.list, NULL);
+	if (with_stat) {
+		vstr_add_str(&iter->path, path);
+		if (iter->path.len > 0) {
+			vstr_add_byte(&iter->path, '/');
+		}
+		iter->dirlen = iter->path.len;
+	}
+	return MP_OBJ_FROM_PTR(iter);
+}
+
+static mp_obj_t vfs_pd_ilistdir(mp_obj_t self_in, mp_obj_t path_in) {
+	return vfs_pd_ilistdir_common(self_in, path_in, false);
 }
 static MP_DEFINE_CONST_FUN_OBJ_2(vfs_pd_ilistdir_obj, vfs_pd_ilistdir);
 
+// VfsPD.ilistdir_stat(path): like ilistdir, but yields (name, type, size,
+// mtime) tuples, saving separate os.stat calls and their result tuples.
+static mp_obj_t vfs_pd_ilistdir_stat(mp_obj_t self_in, mp_obj_t path_in) {
+	return vfs_pd_ilistdir_common(self_in, path_in, true);
+}
+static MP_DEFINE_CONST_FUN_OBJ_2(vfs_pd_ilistdir_stat_obj, vfs_pd_ilistdir_stat);
+
 static mp_obj_t vfs_pd_mkdir(mp_obj_t self_in, mp_obj_t path_in) {
 	mp_obj_vfs_pd_t *self = MP_OBJ_TO_PTR(self_in);
 	if (self->readonly) {
 		mp_raise_OSError(MP_EROFS);
 	}
 	const char *path = vfs_pd_make_path(self, path_in);
+	vfs_pd_cache_invalidate();
 	if (global_pd->file->mkdir(path) < 0) {
 		raise_OSError_pd();
 	}
@@ -248,6 +481,7 @@ static mp_obj_t vfs_pd_remove(mp_obj_t self_in, mp_obj_t path_in) {
 		mp_raise_OSError(MP_EROFS);
 	}
 	const char *path = vfs_pd_make_path(self, path_in);
+	vfs_pd_cache_invalidate();
 	if (global_pd->file->unlink(path, false) < 0) {
 		raise_OSError_pd();
 	}
@@ -268,6 +502,7 @@ static mp_obj_t vfs_pd_rename(mp_obj_t self_in, mp_obj_t old_path_in, mp_obj_t n
 	vstr_add_strn(&old_path_v, old_path, len);
 	old_path = vstr_null_terminated_str(&old_path_v);
 	const char *new_path = vfs_pd_make_path(self, new_path_in);
+	vfs_pd_cache_invalidate();
 	int res = global_pd->file->rename(old_path, new_path);
 	vstr_clear(&old_path_v);
 	if (res < 0) {
@@ -280,7 +515,11 @@ static MP_DEFINE_CONST_FUN_OBJ_3(vfs_pd_rename_obj, vfs_pd_rename);
 static mp_obj_t vfs_pd_stat(mp_obj_t self_in, mp_obj_t path_in) {
 	mp_obj_vfs_pd_t *self = MP_OBJ_TO_PTR(self_in);
 	const char *path = vfs_pd_make_path(self, path_in);
+	if (vfs_pd_cached_stat(self, (char *)path) == MP_IMPORT_STAT_NO_EXIST) {
+		mp_raise_OSError(MP_ENOENT);
+	}
 	FileStat st;
+	vfs_pd_stats.stat++;
 	if (global_pd->file->stat(path, &st) < 0) {
 		raise_OSError_pd();
 	}
@@ -292,7 +531,7 @@ static mp_obj_t vfs_pd_stat(mp_obj_t self_in, mp_obj_t path_in) {
 	t->items[4] = MP_OBJ_NEW_SMALL_INT(0); // uid
 	t->items[5] = MP_OBJ_NEW_SMALL_INT(0); // gid
 	t->items[6] = mp_obj_new_int_from_uint(st.size); // size
-	mp_uint_t time = timeutils_seconds_since_2000(st.m_year, st.m_month, st.m_day, st.m_hour, st.m_minute, st.m_second);
+	mp_uint_t time = vfs_pd_mtime(&st);
 	t->items[7] = mp_obj_new_int_from_uint(time); // atime
 	t->items[8] = mp_obj_new_int_from_uint(time); // mtime
 	t->items[9] = mp_obj_new_int_from_uint(time); // ctime
@@ -300,6 +539,22 @@ static mp_obj_t vfs_pd_stat(mp_obj_t self_in, mp_obj_t path_in) {
 }
 static MP_DEFINE_CONST_FUN_OBJ_2(vfs_pd_stat_obj, vfs_pd_stat);
 
+// VfsPD.stats(): counters of filesystem calls, shared by all mounts
+static mp_obj_t vfs_pd_stats_fun(void) {
+	mp_obj_t d = mp_obj_new_dict(8);
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_import_stat), mp_obj_new_int_from_uint(vfs_pd_stats.import_stat));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_cache_hits), mp_obj_new_int_from_uint(vfs_pd_stats.cache_hits));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_listfiles), mp_obj_new_int_from_uint(vfs_pd_stats.listfiles));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_stat), mp_obj_new_int_from_uint(vfs_pd_stats.stat));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_read_bytes), mp_obj_new_int_from_uint(vfs_pd_stats.read_bytes));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_mpy_hits), mp_obj_new_int_from_uint(vfs_pd_stats.mpy_hits));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_mpy_compiled), mp_obj_new_int_from_uint(vfs_pd_stats.mpy_compiled));
+	mp_obj_dict_store(d, MP_OBJ_NEW_QSTR(MP_QSTR_mpy_compile_ms), mp_obj_new_int_from_uint(vfs_pd_stats.mpy_compile_ms));
+	return d;
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(vfs_pd_stats_fun_obj, vfs_pd_stats_fun);
+static MP_DEFINE_CONST_STATICMETHOD_OBJ(vfs_pd_stats_obj, MP_ROM_PTR(&vfs_pd_stats_fun_obj));
+
 static const mp_rom_map_elem_t vfs_pd_locals_dict_table[] = {
 	{ MP_ROM_QSTR(MP_QSTR_mount), MP_ROM_PTR(&vfs_pd_mount_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_umount), MP_ROM_PTR(&vfs_pd_umount_obj) },
@@ -308,11 +563,13 @@ static const mp_rom_map_elem_t vfs_pd_locals_dict_table[] = {
 	{ MP_ROM_QSTR(MP_QSTR_chdir), MP_ROM_PTR(&vfs_pd_chdir_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_getcwd), MP_ROM_PTR(&vfs_pd_getcwd_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_ilistdir), MP_ROM_PTR(&vfs_pd_ilistdir_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_ilistdir_stat), MP_ROM_PTR(&vfs_pd_ilistdir_stat_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_mkdir), MP_ROM_PTR(&vfs_pd_mkdir_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_remove), MP_ROM_PTR(&vfs_pd_remove_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_rename), MP_ROM_PTR(&vfs_pd_rename_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_rmdir), MP_ROM_PTR(&vfs_pd_remove_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_stat), MP_ROM_PTR(&vfs_pd_stat_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&vfs_pd_stats_obj) },
 	// there's no Playdate API for statvfs
 };
 static MP_DEFINE_CONST_DICT(vfs_pd_locals_dict, vfs_pd_locals_dict_table);
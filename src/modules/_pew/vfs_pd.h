@@ -23,8 +23,51 @@ THE SOFTWARE.
 #pragma once
 
 #include "py/obj.h"
+#include "py/lexer.h"
+
+// default size of the read/write buffer of file objects
+#define VFS_PD_DEFAULT_BUFSIZE (512)
 
 extern const mp_obj_type_t mp_type_vfs_pd;
+extern const mp_obj_type_t mp_type_vfs_pd_fileio;
+extern const mp_obj_type_t mp_type_vfs_pd_textio;
+
+// A file "name" + this suffix containing zlib-compressed data (with a window of
+// at most 2**VFS_PD_COMPRESSED_WBITS bytes, see zcompress.py) can be imported
+// or opened for binary reading as "name" if "name" itself doesn't exist.
+#define VFS_PD_COMPRESSED_SUFFIX ".z"
+#define VFS_PD_COMPRESSED_WBITS (10)
+
+// number of directory listings cached per mount, and maximum size of each
+#define VFS_PD_DIRCACHE_ENTRIES (4)
+#define VFS_PD_DIRCACHE_MAX_BYTES (1024)
+
+// One cached directory listing: the directory's full path, NUL, then all its
+// entries, each NUL-terminated, directories with a trailing '/'.
+typedef struct _vfs_pd_dircache_t {
+	vstr_t data;
+	// valid if equal to the current generation, see vfs_pd_cache_invalidate()
+	uint32_t generation;
+	bool exists;
+	// false if the listing was too large and only the path was kept
+	bool complete;
+} vfs_pd_dircache_t;
+
+typedef struct _vfs_pd_stats_t {
+	mp_uint_t import_stat;
+	mp_uint_t cache_hits;
+	// calls to the corresponding SDK functions
+	mp_uint_t listfiles;
+	mp_uint_t stat;
+	// bytes delivered by the SDK's read to file objects
+	mp_uint_t read_bytes;
+	// bytecode cache, see vfs_pd_mpycache.c
+	mp_uint_t mpy_hits;
+	mp_uint_t mpy_compiled;
+	mp_uint_t mpy_compile_ms;
+} vfs_pd_stats_t;
+
+extern vfs_pd_stats_t vfs_pd_stats;
 
 typedef struct _mp_obj_vfs_pd_t {
 	mp_obj_base_t base;
@@ -33,9 +76,26 @@ typedef struct _mp_obj_vfs_pd_t {
 	// relative to root, starts and ends with '/' (one more '/' than components)
 	vstr_t cur_dir;
 	size_t root_len;
+	// buffer size for files opened without an explicit one
+	mp_int_t bufsize;
 	bool readonly;
+	// compile imported .py files to .mpy files in .mpycache/ under root
+	bool mpycache;
+	// full paths of the last .mpy file claimed by the cache and its cached copy
+	vstr_t mpy_from;
+	vstr_t mpy_to;
+	// sequence of file names in root that import pretends not to find, so
+	// that a later sys.path entry provides those modules
+	mp_obj_t shadowed;
+	vfs_pd_dircache_t dircache[VFS_PD_DIRCACHE_ENTRIES];
+	uint8_t dircache_next;
 } mp_obj_vfs_pd_t;
 
 const char *vfs_pd_make_path(mp_obj_vfs_pd_t *self, mp_obj_t path_in);
+const char *vfs_pd_make_path_str(mp_obj_vfs_pd_t *self, const char *path);
+mp_import_stat_t vfs_pd_cached_stat(mp_obj_vfs_pd_t *self, char *path);
+void vfs_pd_cache_invalidate(void);
 NORETURN void raise_OSError_pd(void);
-mp_obj_t vfs_pd_open(mp_obj_t self_in, mp_obj_t path_in, mp_obj_t mode_in);
+mp_obj_t vfs_pd_open(size_t n_args, const mp_obj_t *args);
+bool vfs_pd_mpycache_import_stat(mp_obj_vfs_pd_t *self, const char *import_path, mp_import_stat_t *stat);
+const char *vfs_pd_mpycache_redirect(mp_obj_vfs_pd_t *self, const char *path);
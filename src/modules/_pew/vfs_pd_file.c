@@ -20,10 +20,14 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include <string.h>
+
 #include "py/runtime.h"
 #include "py/stream.h"
+#include "py/mperrno.h"
 
 #include "vfs_pd.h"
+#include "src/trace.h"
 #if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
 #include "src/globals.h"
 // #else we are in the micropython_embed build which only preprocesses but does
@@ -33,6 +37,17 @@ THE SOFTWARE.
 typedef struct _mp_obj_vfs_pd_file_t {
 	mp_obj_base_t base;
 	SDFile* sdfile;
+	// Allocated on first use, stays NULL if bufsize is 0 (unbuffered).
+	// When reading, buf[bufpos..buflen] is data that the SDK has already
+	// delivered but Python has not consumed yet, so the SDK file position is
+	// ahead of the logical one by buflen - bufpos.
+	// When writing, buf[0..buflen] is data that has not been passed to the SDK
+	// yet, so the SDK file position is behind the logical one by buflen.
+	byte* buf;
+	mp_uint_t bufsize;
+	mp_uint_t bufpos;
+	mp_uint_t buflen;
+	bool writing;
 } mp_obj_vfs_pd_file_t;
 
 static void vfs_pd_file_check_open(mp_obj_vfs_pd_file_t * self) {
@@ -47,26 +62,158 @@ static void vfs_pd_file_print(const mp_print_t * print, mp_obj_t self_in, mp_pri
 	mp_printf(print, "<io.%s>", mp_obj_get_type_str(self_in));
 }
 
-static mp_uint_t vfs_pd_file_read(mp_obj_t self_in, void *buf, mp_uint_t size, int *errcode) {
+// Pass all pending written data to the SDK. Returns 0 or a negative number on
+// error.
+static int vfs_pd_file_flush_write(mp_obj_vfs_pd_file_t *self) {
+	if (!self->writing || self->buflen == 0) {
+		return 0;
+	}
+	TRACE_BEGIN(eTraceFileWrite);
+	mp_uint_t done = 0;
+	while (done < self->buflen) {
+		int len = global_pd->file->write(self->sdfile, self->buf + done, self->buflen - done);
+		if (len <= 0) {
+			TRACE_END(eTraceFileWrite);
+			// keep what couldn't be written at the start of the buffer
+			memmove(self->buf, self->buf + done, self->buflen - done);
+			self->buflen -= done;
+			return -1;
+		}
+		done += len;
+	}
+	self->buflen = 0;
+	// flushing appears necessary to avoid "I/O Error"
+	// https://devforum.play.date/t/i-o-error-when-writing-files-from-c-coroutine/24137
+	int res = global_pd->file->flush(self->sdfile);
+	TRACE_END(eTraceFileWrite);
+	return res;
+}
+
+// Give back data read ahead into the buffer by moving the SDK file position
+// back to the logical one. Returns 0 or a negative number on error.
+static int vfs_pd_file_drop_read(mp_obj_vfs_pd_file_t *self) {
+	if (self->writing) {
+		return 0;
+	}
+	mp_uint_t unread = self->buflen - self->bufpos;
+	self->bufpos = self->buflen = 0;
+	if (unread > 0) {
+		return global_pd->file->seek(self->sdfile, -(int)unread, SEEK_CUR);
+	}
+	return 0;
+}
+
+static int vfs_pd_file_start_reading(mp_obj_vfs_pd_file_t *self) {
+	if (self->writing) {
+		int res = vfs_pd_file_flush_write(self);
+		if (res < 0) {
+			return res;
+		}
+		self->writing = false;
+		self->bufpos = self->buflen = 0;
+	}
+	return 0;
+}
+
+// Refill an empty read buffer. Returns the number of bytes read (0 at end of
+// file) or a negative number on error.
+static int vfs_pd_file_fill(mp_obj_vfs_pd_file_t *self) {
+	if (self->buf == NULL) {
+		self->buf = m_new(byte, self->bufsize);
+	}
+	TRACE_BEGIN(eTraceFileRead);
+	int len = global_pd->file->read(self->sdfile, self->buf, self->bufsize);
+	TRACE_END(eTraceFileRead);
+	if (len > 0) {
+		vfs_pd_stats.read_bytes += len;
+	}
+	self->bufpos = 0;
+	self->buflen = (len < 0) ? 0 : len;
+	return len;
+}
+
+static mp_uint_t vfs_pd_file_read(mp_obj_t self_in, void *buf_in, mp_uint_t size, int *errcode) {
 	mp_obj_vfs_pd_file_t *self = MP_OBJ_TO_PTR(self_in);
 	vfs_pd_file_check_open(self);
-	int len = global_pd->file->read(self->sdfile, buf, size);
-	if (len < 0) {
+	if (vfs_pd_file_start_reading(self) < 0) {
 		*errcode = MP_EIO;
 		return MP_STREAM_ERROR;
 	}
-	return len;
+	byte *buf = buf_in;
+	mp_uint_t done = 0;
+	while (done < size) {
+		mp_uint_t avail = self->buflen - self->bufpos;
+		if (avail > 0) {
+			if (avail > size - done) {
+				avail = size - done;
+			}
+			memcpy(buf + done, self->buf + self->bufpos, avail);
+			self->bufpos += avail;
+			done += avail;
+			continue;
+		}
+		int len;
+		if (size - done >= self->bufsize) {
+			// large read (or unbuffered): no point in copying through the buffer
+			TRACE_BEGIN(eTraceFileRead);
+			len = global_pd->file->read(self->sdfile, buf + done, size - done);
+			TRACE_END(eTraceFileRead);
+			if (len > 0) {
+				vfs_pd_stats.read_bytes += len;
+				done += len;
+			}
+		}
+		else {
+			len = vfs_pd_file_fill(self);
+		}
+		if (len < 0) {
+			if (done > 0) {
+				break;
+			}
+			*errcode = MP_EIO;
+			return MP_STREAM_ERROR;
+		}
+		if (len == 0) {
+			break;
+		}
+	}
+	return done;
 }
 
 static mp_uint_t vfs_pd_file_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode) {
 	mp_obj_vfs_pd_file_t *self = MP_OBJ_TO_PTR(self_in);
 	vfs_pd_file_check_open(self);
-	int len = global_pd->file->write(self->sdfile, buf, size);
-	if (len < 0) {
-		*errcode = MP_EIO;
-		return MP_STREAM_ERROR;
+	if (!self->writing) {
+		if (vfs_pd_file_drop_read(self) < 0) {
+			*errcode = MP_EIO;
+			return MP_STREAM_ERROR;
+		}
+		self->writing = true;
 	}
-	return len;
+	if (self->buflen > 0 && self->buflen + size > self->bufsize) {
+		if (vfs_pd_file_flush_write(self) < 0) {
+			*errcode = MP_EIO;
+			return MP_STREAM_ERROR;
+		}
+	}
+	if (size >= self->bufsize) {
+		// large write (or unbuffered): pass it through directly
+		TRACE_BEGIN(eTraceFileWrite);
+		int len = global_pd->file->write(self->sdfile, buf, size);
+		int res = (len < 0) ? len : global_pd->file->flush(self->sdfile);
+		TRACE_END(eTraceFileWrite);
+		if (len < 0 || res < 0) {
+			*errcode = MP_EIO;
+			return MP_STREAM_ERROR;
+		}
+		return len;
+	}
+	if (self->buf == NULL) {
+		self->buf = m_new(byte, self->bufsize);
+	}
+	memcpy(self->buf + self->buflen, buf, size);
+	self->buflen += size;
+	return size;
 }
 
 static mp_uint_t vfs_pd_file_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
@@ -78,6 +225,31 @@ static mp_uint_t vfs_pd_file_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_
 
 	if (request == MP_STREAM_SEEK) {
 		struct mp_stream_seek_t *s = (struct mp_stream_seek_t *)(uintptr_t)arg;
+		if (!self->writing && s->whence == SEEK_CUR
+			&& s->offset >= -(mp_off_t)self->bufpos
+			&& s->offset <= (mp_off_t)(self->buflen - self->bufpos))
+		{
+			// Target is within the read buffer (this includes tell()), keep
+			// the buffer and only ask the SDK where it is.
+			self->bufpos += s->offset;
+			int res = global_pd->file->tell(self->sdfile);
+			if (res < 0) {
+				*errcode = MP_EIO;
+				return MP_STREAM_ERROR;
+			}
+			s->offset = res - (self->buflen - self->bufpos);
+			return 0;
+		}
+		if (self->writing) {
+			if (vfs_pd_file_flush_write(self) < 0) {
+				*errcode = MP_EIO;
+				return MP_STREAM_ERROR;
+			}
+		}
+		else if (s->whence == SEEK_CUR) {
+			s->offset -= self->buflen - self->bufpos;
+		}
+		self->bufpos = self->buflen = 0;
 		int res = global_pd->file->seek(self->sdfile, s->offset, s->whence);
 		if (res < 0) {
 			*errcode = MP_EINVAL;
@@ -92,7 +264,10 @@ static mp_uint_t vfs_pd_file_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_
 		return 0;
 	}
 	else if (request == MP_STREAM_FLUSH) {
-		int res = global_pd->file->flush(self->sdfile);
+		int res = vfs_pd_file_flush_write(self);
+		if (res >= 0) {
+			res = global_pd->file->flush(self->sdfile);
+		}
 		if (res < 0) {
 			*errcode = MP_EIO;
 			return MP_STREAM_ERROR;
@@ -103,8 +278,14 @@ static mp_uint_t vfs_pd_file_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_
 		if (self->sdfile == NULL) {
 			return 0;
 		}
-		int res = global_pd->file->close(self->sdfile);
+		int res = vfs_pd_file_flush_write(self);
+		if (global_pd->file->close(self->sdfile) < 0) {
+			res = -1;
+		}
 		self->sdfile = NULL; // indicate a closed file
+		m_del(byte, self->buf, self->bufsize);
+		self->buf = NULL;
+		self->bufpos = self->buflen = 0;
 		if (res < 0) {
 			*errcode = MP_EIO;
 			return MP_STREAM_ERROR;
@@ -117,6 +298,129 @@ static mp_uint_t vfs_pd_file_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_
 	}
 }
 
+static mp_obj_t vfs_pd_file_new_data(mp_obj_vfs_pd_file_t *self, vstr_t *vstr) {
+	if (self->base.type == &mp_type_vfs_pd_textio) {
+		return mp_obj_new_str_from_vstr(vstr);
+	}
+	return mp_obj_new_bytes_from_vstr(vstr);
+}
+
+// read() without a size: rather than growing the result in steps like
+// mp_stream_read does, find out how much is left and allocate exactly that.
+static mp_obj_t vfs_pd_file_read_method(size_t n_args, const mp_obj_t *args) {
+	mp_obj_vfs_pd_file_t *self = MP_OBJ_TO_PTR(args[0]);
+	if (n_args > 1 && args[1] != mp_const_none && mp_obj_get_int(args[1]) >= 0) {
+		return mp_call_function_n_kw(MP_OBJ_FROM_PTR(&mp_stream_read_obj), n_args, 0, args);
+	}
+	vfs_pd_file_check_open(self);
+	if (vfs_pd_file_start_reading(self) < 0) {
+		mp_raise_OSError(MP_EIO);
+	}
+	int pos = global_pd->file->tell(self->sdfile);
+	int end = -1;
+	if (pos >= 0 && global_pd->file->seek(self->sdfile, 0, SEEK_END) >= 0) {
+		end = global_pd->file->tell(self->sdfile);
+		if (global_pd->file->seek(self->sdfile, pos, SEEK_SET) < 0) {
+			mp_raise_OSError(MP_EIO);
+		}
+	}
+	if (end < pos) {
+		// can't determine the size, let the generic implementation deal with it
+		return mp_call_function_n_kw(MP_OBJ_FROM_PTR(&mp_stream_read_obj), 1, 0, args);
+	}
+	mp_uint_t remaining = (end - pos) + (self->buflen - self->bufpos);
+	vstr_t vstr;
+	vstr_init(&vstr, remaining + 1);
+	int errcode;
+	mp_uint_t len = vfs_pd_file_read(args[0], vstr.buf, remaining, &errcode);
+	if (len == MP_STREAM_ERROR) {
+		vstr_clear(&vstr);
+		mp_raise_OSError(errcode);
+	}
+	vstr.len = len;
+	return vfs_pd_file_new_data(self, &vstr);
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(vfs_pd_file_read_obj, 1, 2, vfs_pd_file_read_method);
+
+// Returns MP_OBJ_STOP_ITERATION instead of an empty line at the end of the
+// file if stop is true.
+static mp_obj_t vfs_pd_file_do_readline(mp_obj_vfs_pd_file_t *self, mp_int_t max_size, bool stop) {
+	vfs_pd_file_check_open(self);
+	if (vfs_pd_file_start_reading(self) < 0) {
+		mp_raise_OSError(MP_EIO);
+	}
+	vstr_t vstr;
+	vstr_init(&vstr, 16);
+	while (max_size != 0) {
+		if (self->bufpos == self->buflen) {
+			int len = vfs_pd_file_fill(self);
+			if (len < 0) {
+				vstr_clear(&vstr);
+				mp_raise_OSError(MP_EIO);
+			}
+			if (len == 0) {
+				break;
+			}
+		}
+		const byte *start = self->buf + self->bufpos;
+		mp_uint_t n = self->buflen - self->bufpos;
+		if (max_size > 0 && n > (mp_uint_t)max_size) {
+			n = max_size;
+		}
+		const byte *nl = memchr(start, '\n', n);
+		if (nl != NULL) {
+			n = nl - start + 1;
+		}
+		vstr_add_strn(&vstr, (const char *)start, n);
+		self->bufpos += n;
+		if (max_size > 0) {
+			max_size -= n;
+		}
+		if (nl != NULL) {
+			break;
+		}
+	}
+	if (stop && vstr.len == 0) {
+		vstr_clear(&vstr);
+		return MP_OBJ_STOP_ITERATION;
+	}
+	return vfs_pd_file_new_data(self, &vstr);
+}
+
+static mp_obj_t vfs_pd_file_readline(size_t n_args, const mp_obj_t *args) {
+	mp_obj_vfs_pd_file_t *self = MP_OBJ_TO_PTR(args[0]);
+	if (self->bufsize == 0) {
+		return mp_call_function_n_kw(MP_OBJ_FROM_PTR(&mp_stream_unbuffered_readline_obj), n_args, 0, args);
+	}
+	mp_int_t max_size = -1;
+	if (n_args > 1) {
+		max_size = mp_obj_get_int(args[1]);
+	}
+	return vfs_pd_file_do_readline(self, max_size, false);
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(vfs_pd_file_readline_obj, 1, 2, vfs_pd_file_readline);
+
+static mp_obj_t vfs_pd_file_iternext(mp_obj_t self_in) {
+	mp_obj_vfs_pd_file_t *self = MP_OBJ_TO_PTR(self_in);
+	if (self->bufsize == 0) {
+		return mp_stream_unbuffered_iter(self_in);
+	}
+	return vfs_pd_file_do_readline(self, -1, true);
+}
+
+static mp_obj_t vfs_pd_file_readlines(mp_obj_t self_in) {
+	mp_obj_t lines = mp_obj_new_list(0, NULL);
+	for (;;) {
+		mp_obj_t line = vfs_pd_file_iternext(self_in);
+		if (line == MP_OBJ_STOP_ITERATION) {
+			break;
+		}
+		mp_obj_list_append(lines, line);
+	}
+	return lines;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(vfs_pd_file_readlines_obj, vfs_pd_file_readlines);
+
 static const mp_stream_p_t vfs_pd_fileio_stream_p = {
 	.read = vfs_pd_file_read,
 	.write = vfs_pd_file_write,
@@ -131,10 +435,10 @@ static const mp_stream_p_t vfs_pd_textio_stream_p = {
 };
 
 static const mp_rom_map_elem_t vfs_pd_rawfile_locals_dict_table[] = {
-	{ MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&mp_stream_read_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&vfs_pd_file_read_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
-	{ MP_ROM_QSTR(MP_QSTR_readline), MP_ROM_PTR(&mp_stream_unbuffered_readline_obj) },
-	{ MP_ROM_QSTR(MP_QSTR_readlines), MP_ROM_PTR(&mp_stream_unbuffered_readlines_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readline), MP_ROM_PTR(&vfs_pd_file_readline_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readlines), MP_ROM_PTR(&vfs_pd_file_readlines_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&mp_stream_write_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_flush), MP_ROM_PTR(&mp_stream_flush_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&mp_stream_close_obj) },
@@ -149,8 +453,9 @@ static MP_DEFINE_CONST_DICT(vfs_pd_rawfile_locals_dict, vfs_pd_rawfile_locals_di
 MP_DEFINE_CONST_OBJ_TYPE(
 	mp_type_vfs_pd_fileio,
 	MP_QSTR_FileIO,
-	MP_TYPE_FLAG_ITER_IS_STREAM,
+	MP_TYPE_FLAG_ITER_IS_ITERNEXT,
 	print, vfs_pd_file_print,
+	iter, vfs_pd_file_iternext,
 	protocol, &vfs_pd_fileio_stream_p,
 	locals_dict, &vfs_pd_rawfile_locals_dict
 	);
@@ -158,17 +463,21 @@ MP_DEFINE_CONST_OBJ_TYPE(
 MP_DEFINE_CONST_OBJ_TYPE(
 	mp_type_vfs_pd_textio,
 	MP_QSTR_TextIOWrapper,
-	MP_TYPE_FLAG_ITER_IS_STREAM,
+	MP_TYPE_FLAG_ITER_IS_ITERNEXT,
 	print, vfs_pd_file_print,
+	iter, vfs_pd_file_iternext,
 	protocol, &vfs_pd_textio_stream_p,
 	locals_dict, &vfs_pd_rawfile_locals_dict
 	);
 
-mp_obj_t vfs_pd_open(mp_obj_t self_in, mp_obj_t path_in, mp_obj_t mode_in) {
-	mp_obj_vfs_pd_t *self = MP_OBJ_TO_PTR(self_in);
+// VfsPD.open(path, mode[, buffering]): buffering is the buffer size in bytes,
+// 0 for unbuffered, negative (or absent) for the default of the mount.
+mp_obj_t vfs_pd_open(size_t n_args, const mp_obj_t *args) {
+	mp_obj_vfs_pd_t *self = MP_OBJ_TO_PTR(args[0]);
+	mp_obj_t path_in = args[1];
 	FileOptions mode = kFileRead|kFileReadData;
 	const mp_obj_type_t *type = &mp_type_vfs_pd_textio;
-	const char *mode_str = mp_obj_str_get_str(mode_in);
+	const char *mode_str = mp_obj_str_get_str(args[2]);
 	for (; *mode_str; ++mode_str) {
 		switch (*mode_str) {
 			case 'r':
@@ -193,15 +502,55 @@ mp_obj_t vfs_pd_open(mp_obj_t self_in, mp_obj_t path_in, mp_obj_t mode_in) {
 				break;
 		}
 	}
+	mp_int_t bufsize = -1;
+	if (n_args > 3) {
+		bufsize = mp_obj_get_int(args[3]);
+	}
+	if (bufsize < 0) {
+		bufsize = self->bufsize;
+	}
 	if (self->readonly && (mode & (kFileWrite|kFileAppend))) {
 		mp_raise_OSError(MP_EROFS);
 	}
 	const char *path = vfs_pd_make_path(self, path_in);
+	if (self->mpycache) {
+		path = vfs_pd_mpycache_redirect(self, path);
+	}
+	if (mode & (kFileWrite|kFileAppend)) {
+		vfs_pd_cache_invalidate();
+	}
+	TRACE_BEGIN(eTraceFileOpen);
 	SDFile* f = global_pd->file->open(path, mode);
+	bool compressed = false;
+	if (f == NULL && type == &mp_type_vfs_pd_fileio && !(mode & (kFileWrite|kFileAppend))) {
+		// try a compressed variant
+		vstr_add_str(&self->root, VFS_PD_COMPRESSED_SUFFIX);
+		f = global_pd->file->open(vstr_null_terminated_str(&self->root), mode);
+		compressed = true;
+	}
+	TRACE_END(eTraceFileOpen);
 	if (f == NULL) {
 		raise_OSError_pd();
 	}
 	mp_obj_vfs_pd_file_t *o = mp_obj_malloc_with_finaliser(mp_obj_vfs_pd_file_t, type);
 	o->sdfile = f;
+	o->buf = NULL;
+	o->bufsize = bufsize;
+	o->bufpos = 0;
+	o->buflen = 0;
+	o->writing = false;
+	if (compressed) {
+		// Decompress on the fly with deflate.DeflateIO, which reads its input
+		// byte by byte (served from our buffer) and only needs a window of fixed
+		// size, so the compressed file is never loaded as a whole.
+		mp_obj_t deflate = mp_import_name(MP_QSTR_deflate, mp_const_none, MP_OBJ_NEW_SMALL_INT(0));
+		mp_obj_t args[4] = {
+			MP_OBJ_FROM_PTR(o),
+			mp_load_attr(deflate, MP_QSTR_ZLIB),
+			MP_OBJ_NEW_SMALL_INT(VFS_PD_COMPRESSED_WBITS),
+			mp_const_true, // close o when closed
+		};
+		return mp_call_function_n_kw(mp_load_attr(deflate, MP_QSTR_DeflateIO), 4, 0, args);
+	}
 	return MP_OBJ_FROM_PTR(o);
 }
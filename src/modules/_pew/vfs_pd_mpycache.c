@@ -0,0 +1,332 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/compile.h"
+#include "py/persistentcode.h"
+#include "py/reader.h"
+
+#include "vfs_pd.h"
+#if defined(TARGET_PLAYDATE) || defined(TARGET_SIMULATOR)
+#include "src/globals.h"
+// #else we are in the micropython_embed build which only preprocesses but does
+// not compile, and does not have the Playdate SDK
+#endif
+
+// Bytecode cache: when a VfsPD created with mpycache=True is asked by import
+// whether "x.py" exists, it makes sure there is a compiled copy in
+// .mpycache/ under its root, named after a hash of the source path and a hash
+// of its size, modification time and the .mpy version. It then claims that
+// "x.py" does not exist, so that import goes on to look for "x.mpy", which is
+// redirected to the cached file. Changing the source changes the name, so
+// stale entries are never used, and they are deleted when a new one for the
+// same source is written.
+
+#define MPYCACHE_DIR ".mpycache"
+// suffix of the file being written, until it is complete
+#define MPYCACHE_TMP_SUFFIX ".tmp"
+// number of sources remembered as failing to compile
+#define MPYCACHE_FAILED 4
+
+static uint32_t mpycache_hash(uint32_t h, const void *data, size_t len) {
+	const byte *p = data;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+	return h;
+}
+
+typedef struct _mpycache_reader_t {
+	SDFile *f;
+	uint16_t pos;
+	uint16_t len;
+	byte buf[128];
+} mpycache_reader_t;
+
+static mp_uint_t mpycache_readbyte(void *data) {
+	mpycache_reader_t *r = data;
+	if (r->pos == r->len) {
+		int n = global_pd->file->read(r->f, r->buf, sizeof(r->buf));
+		if (n <= 0) {
+			return MP_READER_EOF;
+		}
+		r->pos = 0;
+		r->len = n;
+	}
+	return r->buf[r->pos++];
+}
+
+static void mpycache_reader_close(void *data) {
+	mpycache_reader_t *r = data;
+	global_pd->file->close(r->f);
+	m_del_obj(mpycache_reader_t, r);
+}
+
+typedef struct _mpycache_writer_t {
+	SDFile *f;
+	size_t len;
+	bool error;
+	byte buf[256];
+} mpycache_writer_t;
+
+static void mpycache_writer_flush(mpycache_writer_t *w) {
+	if (w->len > 0 && !w->error) {
+		// flushing appears necessary to avoid "I/O Error", see vfs_pd_file.c
+		if (global_pd->file->write(w->f, w->buf, w->len) != (int)w->len
+			|| global_pd->file->flush(w->f) < 0)
+		{
+			w->error = true;
+		}
+	}
+	w->len = 0;
+}
+
+static void mpycache_print_strn(void *data, const char *str, size_t len) {
+	mpycache_writer_t *w = data;
+	while (len > 0) {
+		size_t n = sizeof(w->buf) - w->len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(w->buf + w->len, str, n);
+		w->len += n;
+		str += n;
+		len -= n;
+		if (w->len == sizeof(w->buf)) {
+			mpycache_writer_flush(w);
+		}
+	}
+}
+
+// Compile the source file at SDK path source into an .mpy file at SDK path
+// cache. Returns false if anything went wrong, in which case the regular
+// import should take over and report any errors. The .mpy file is written
+// under a temporary name and renamed into place when complete, so that a
+// failure halfway (e.g. MemoryError while saving constants) cannot leave a
+// truncated file that later imports would load.
+static bool mpycache_compile(const char *source, qstr source_name, const char *cache) {
+	// allocate first, this may raise
+	mpycache_reader_t *r = m_new_obj(mpycache_reader_t);
+	SDFile *f = global_pd->file->open(source, kFileRead|kFileReadData);
+	if (f == NULL) {
+		m_del_obj(mpycache_reader_t, r);
+		return false;
+	}
+	r->f = f;
+	r->pos = r->len = 0;
+	mp_reader_t reader = { r, mpycache_readbyte, mpycache_reader_close };
+
+	mp_lexer_t *volatile lex = NULL;
+	nlr_buf_t nlr;
+	if (nlr_push(&nlr) != 0) {
+		if (lex == NULL) {
+			// mp_lexer_new() failed before it could take over the reader
+			mpycache_reader_close(r);
+		}
+		// else the lexer has closed the reader
+		return false;
+	}
+	lex = mp_lexer_new(source_name, reader);
+	mp_parse_tree_t parse_tree = mp_parse(lex, MP_PARSE_FILE_INPUT);
+	mp_compiled_module_t cm = { .context = m_new_obj(mp_module_context_t) };
+	mp_compile_to_raw_code(&parse_tree, source_name, false, &cm);
+	// allocations for writing, here so that failing them is not an error
+	vstr_t tmp;
+	vstr_init(&tmp, strlen(cache) + sizeof(MPYCACHE_TMP_SUFFIX));
+	vstr_add_str(&tmp, cache);
+	vstr_add_str(&tmp, MPYCACHE_TMP_SUFFIX);
+	const char *tmp_path = vstr_null_terminated_str(&tmp);
+	mpycache_writer_t *w = m_new_obj(mpycache_writer_t);
+	nlr_pop();
+
+	w->f = global_pd->file->open(tmp_path, kFileWrite);
+	if (w->f == NULL) {
+		m_del_obj(mpycache_writer_t, w);
+		vstr_clear(&tmp);
+		return false;
+	}
+	w->len = 0;
+	w->error = false;
+	volatile bool ok = false;
+	if (nlr_push(&nlr) == 0) {
+		mp_print_t print = { w, mpycache_print_strn };
+		mp_raw_code_save(&cm, &print);
+		mpycache_writer_flush(w);
+		ok = !w->error;
+		nlr_pop();
+	}
+	// else ok stays false, the exception is dropped like one from compiling
+	ok = (global_pd->file->close(w->f) == 0) && ok;
+	m_del_obj(mpycache_writer_t, w);
+	if (!ok || global_pd->file->rename(tmp_path, cache) != 0) {
+		global_pd->file->unlink(tmp_path, false);
+		ok = false;
+	}
+	vstr_clear(&tmp);
+	return ok;
+}
+
+// Sources (by path hash and key as in the cache file name) that could not be
+// compiled, mostly because of syntax errors, so that each import of them
+// doesn't parse them twice, once here and once by the regular import. A
+// changed source gets a different key and is tried again.
+static struct {
+	uint32_t pathhash;
+	uint32_t key;
+} mpycache_failed[MPYCACHE_FAILED];
+static size_t mpycache_failed_next;
+
+static bool mpycache_has_failed(uint32_t pathhash, uint32_t key) {
+	for (size_t i = 0; i < MPYCACHE_FAILED; i++) {
+		if (mpycache_failed[i].pathhash == pathhash && mpycache_failed[i].key == key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void mpycache_set_failed(uint32_t pathhash, uint32_t key) {
+	mpycache_failed[mpycache_failed_next].pathhash = pathhash;
+	mpycache_failed[mpycache_failed_next].key = key;
+	mpycache_failed_next = (mpycache_failed_next + 1) % MPYCACHE_FAILED;
+}
+
+typedef struct {
+	vstr_t *stale;
+	const char *prefix;
+} mpycache_stale_userdata_t;
+
+static void mpycache_stale_callback(const char *filename, void *userdata) {
+	mpycache_stale_userdata_t *ud = userdata;
+	if (strncmp(filename, ud->prefix, 9) == 0) {
+		vstr_add_strn(ud->stale, filename, strlen(filename) + 1);
+	}
+}
+
+// Remove the cached files in dir (with trailing /) whose names start with the
+// same path hash as name.
+static void mpycache_remove_stale(const char *dir, size_t dirlen, const char *name) {
+	vstr_t stale;
+	vstr_init(&stale, 32);
+	mpycache_stale_userdata_t ud = { &stale, name };
+	vstr_t path;
+	vstr_init(&path, dirlen + 32);
+	vstr_add_strn(&path, dir, dirlen - 1);
+	vfs_pd_stats.listfiles++;
+	global_pd->file->listfiles(vstr_null_terminated_str(&path), &mpycache_stale_callback, &ud, true);
+	for (const char *p = stale.buf; p < stale.buf + stale.len; p += strlen(p) + 1) {
+		path.len = dirlen - 1;
+		vstr_add_byte(&path, '/');
+		vstr_add_str(&path, p);
+		global_pd->file->unlink(vstr_null_terminated_str(&path), false);
+	}
+	vstr_clear(&path);
+	vstr_clear(&stale);
+}
+
+// Called from import_stat with the full path of import_path in self->root and
+// its plain stat result. Returns true and sets *stat if the cache overrides
+// the result.
+bool vfs_pd_mpycache_import_stat(mp_obj_vfs_pd_t *self, const char *import_path, mp_import_stat_t *stat) {
+	char *full = vstr_null_terminated_str(&self->root);
+	size_t len = self->root.len;
+
+	if (*stat == MP_IMPORT_STAT_NO_EXIST) {
+		if (self->mpy_from.len > 0 && strcmp(full, vstr_null_terminated_str(&self->mpy_from)) == 0) {
+			*stat = MP_IMPORT_STAT_FILE;
+			return true;
+		}
+		return false;
+	}
+	if (*stat != MP_IMPORT_STAT_FILE || self->readonly || len < 3 || strcmp(full + len - 3, ".py") != 0) {
+		return false;
+	}
+
+	FileStat st;
+	vfs_pd_stats.stat++;
+	if (global_pd->file->stat(full, &st) < 0) {
+		return false;
+	}
+	uint32_t pathhash = mpycache_hash(2166136261u, full, len);
+	uint32_t key = mpycache_hash(pathhash, &st, sizeof(st));
+	static const byte version[2] = { MPY_VERSION, MPY_SUB_VERSION };
+	key = mpycache_hash(key, version, sizeof(version));
+	char name[24];
+	snprintf(name, sizeof(name), "%08x-%08x.mpy", (unsigned int)pathhash, (unsigned int)key);
+	if (mpycache_has_failed(pathhash, key)) {
+		vstr_reset(&self->mpy_from);
+		return false;
+	}
+
+	// "x.py" -> "x.mpy"
+	vstr_reset(&self->mpy_from);
+	vstr_add_strn(&self->mpy_from, full, len - 2);
+	vstr_add_str(&self->mpy_from, "mpy");
+	vstr_t source;
+	vstr_init(&source, len + 1);
+	vstr_add_strn(&source, full, len);
+	// root prefix (with trailing /) + MPYCACHE_DIR/name
+	vstr_reset(&self->mpy_to);
+	vstr_add_strn(&self->mpy_to, full, self->root_len);
+	vstr_add_str(&self->mpy_to, MPYCACHE_DIR "/");
+	size_t dirlen = self->mpy_to.len;
+	vstr_add_str(&self->mpy_to, name);
+
+	if (vfs_pd_cached_stat(self, vstr_null_terminated_str(&self->mpy_to)) == MP_IMPORT_STAT_FILE) {
+		vfs_pd_stats.mpy_hits++;
+		vstr_clear(&source);
+		*stat = MP_IMPORT_STAT_NO_EXIST;
+		return true;
+	}
+
+	uint32_t start = global_pd->system->getCurrentTimeMilliseconds();
+	char *to = vstr_null_terminated_str(&self->mpy_to);
+	to[dirlen - 1] = '\0';
+	if (vfs_pd_cached_stat(self, to) == MP_IMPORT_STAT_NO_EXIST) {
+		global_pd->file->mkdir(to);
+	}
+	to[dirlen - 1] = '/';
+	mpycache_remove_stale(to, dirlen, name);
+	bool ok = mpycache_compile(vstr_null_terminated_str(&source), qstr_from_str(import_path), vstr_null_terminated_str(&self->mpy_to));
+	vstr_clear(&source);
+	vfs_pd_cache_invalidate();
+	if (!ok) {
+		mpycache_set_failed(pathhash, key);
+		vstr_reset(&self->mpy_from);
+		return false;
+	}
+	vfs_pd_stats.mpy_compiled++;
+	vfs_pd_stats.mpy_compile_ms += global_pd->system->getCurrentTimeMilliseconds() - start;
+	*stat = MP_IMPORT_STAT_NO_EXIST;
+	return true;
+}
+
+// Path to actually open for a full path from vfs_pd_make_path.
+const char *vfs_pd_mpycache_redirect(mp_obj_vfs_pd_t *self, const char *path) {
+	if (self->mpy_from.len > 0 && strcmp(path, vstr_null_terminated_str(&self->mpy_from)) == 0) {
+		return vstr_null_terminated_str(&self->mpy_to);
+	}
+	return path;
+}
@@ -7,7 +7,7 @@
 
 
 from micropython import const
-from _pew import show as _show, keys, tick
+from _pew import show as _show, keys, tick, TICK_CATCHUP, TICK_SKIP, TICK_RESET
 
 
 _FONT = (
@@ -21,9 +21,12 @@ THE SOFTWARE.
 */
 
 #include "py/builtin.h"
+#include "py/gc.h"
 #include "py/compile.h"
 #include "py/mperrno.h"
 #include "py/mphal.h"
+#include "py/mpstate.h"
+#include "py/persistentcode.h"
 #if MICROPY_PY_SYS_STDFILES
 #include "py/stream.h"
 #endif
@@ -33,8 +36,19 @@ THE SOFTWARE.
 
 #include "playdate-coroutines/pdco.h"
 
+#if defined(TARGET_SIMULATOR) && MICROPY_EMIT_X64
+#include <sys/mman.h>
+#endif
+#if defined(TARGET_SIMULATOR) && defined(_WIN32)
+#include <windows.h>
+#elif defined(TARGET_SIMULATOR)
+#include <time.h>
+#endif
+
 #include "globals.h"
 #include "terminal.h"
+#include "framestats.h"
+#include "trace.h"
 
 #ifndef MICROPY_HW_STDIN_BUFFER_LEN
 #define MICROPY_HW_STDIN_BUFFER_LEN 512
@@ -68,6 +82,219 @@ mp_uint_t mp_hal_ticks_ms(void) {
 
 #endif
 
+// High-resolution clock. On the device, if built with PEW_CYCLE_COUNTER (see
+// mpconfigport.h), this is the Cortex-M7 cycle counter, whose frequency is
+// measured against the millisecond clock at startup, and extended to 64 bits
+// by noticing when it wraps around. That takes about 25 seconds, and we are
+// normally called at least once per frame, but not while the game is paused in
+// the system menu, so after long gaps the millisecond clock is used to bridge
+// them. Otherwise, or if the cycle counter turns out to be missing or not to
+// run, getElapsedTime() is used as before and "CPU ticks" are microseconds.
+// On the simulator, the host's monotonic clock is used and "CPU ticks" are
+// nanoseconds.
+
+uint64_t pd_hal_clock_start_us;
+
+#if defined(TARGET_PLAYDATE) && PEW_CYCLE_COUNTER
+
+#define DEMCR (*(volatile uint32_t*)0xE000EDFC)
+#define DEMCR_TRCENA (1u << 24)
+#define DWT_CTRL (*(volatile uint32_t*)0xE0001000)
+#define DWT_CTRL_CYCCNTENA (1u << 0)
+#define DWT_CTRL_NOCYCCNT (1u << 25)
+#define DWT_CYCCNT (*(volatile uint32_t*)0xE0001004)
+#define DWT_LAR (*(volatile uint32_t*)0xE0001FB0)
+#define DWT_LAR_UNLOCK 0xC5ACCE55u
+
+// duration of the frequency measurement
+#define PD_HAL_CLOCK_CALIBRATE_MS 10
+
+static uint32_t clockCyclesPerUs = 0;
+static uint32_t clockResyncMs;
+static uint32_t clockLastCycles;
+static uint32_t clockLastMs;
+static uint32_t clockRemainder;
+static uint64_t clockUs;
+
+void pd_hal_clock_init(void) {
+	// This assumes that the game runs privileged, which has not been verified
+	// on hardware yet, hence PEW_CYCLE_COUNTER. The DWT registers may only be
+	// readable once trace is enabled.
+	DEMCR |= DEMCR_TRCENA;
+	if (DWT_CTRL & DWT_CTRL_NOCYCCNT) {
+		// no cycle counter, clockCyclesPerUs stays 0
+		pd_hal_clock_start_us = pd_hal_ticks_us64();
+		return;
+	}
+	if (!(DWT_CTRL & DWT_CTRL_CYCCNTENA)) {
+		// not already running for the system or a debugger
+		DWT_LAR = DWT_LAR_UNLOCK;
+		DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+	}
+	// start at a millisecond boundary
+	uint32_t ms = global_pd->system->getCurrentTimeMilliseconds();
+	uint32_t start;
+	while ((start = global_pd->system->getCurrentTimeMilliseconds()) == ms) {}
+	uint32_t cycles = DWT_CYCCNT;
+	while (global_pd->system->getCurrentTimeMilliseconds() - start < PD_HAL_CLOCK_CALIBRATE_MS) {}
+	cycles = DWT_CYCCNT - cycles;
+	// round to whole MHz
+	clockCyclesPerUs = (cycles + PD_HAL_CLOCK_CALIBRATE_MS * 500) / (PD_HAL_CLOCK_CALIBRATE_MS * 1000);
+	if (clockCyclesPerUs != 0) {
+		// half of the wrap-around period, to be safe
+		clockResyncMs = 0x80000000u / (clockCyclesPerUs * 1000);
+		clockLastCycles = DWT_CYCCNT;
+		clockLastMs = global_pd->system->getCurrentTimeMilliseconds();
+		clockRemainder = 0;
+		clockUs = (uint64_t)clockLastMs * 1000;
+	}
+	pd_hal_clock_start_us = pd_hal_ticks_us64();
+}
+
+uint64_t pd_hal_ticks_us64(void) {
+	if (clockCyclesPerUs == 0) {
+		return (uint64_t)(1.0e6f * global_pd->system->getElapsedTime());
+	}
+	uint32_t cycles = DWT_CYCCNT;
+	uint32_t ms = global_pd->system->getCurrentTimeMilliseconds();
+	if (ms - clockLastMs >= clockResyncMs) {
+		// the cycle counter may have wrapped around, possibly several times
+		clockUs += (uint64_t)(ms - clockLastMs) * 1000;
+		clockRemainder = 0;
+	}
+	else {
+		uint32_t elapsed = cycles - clockLastCycles + clockRemainder;
+		clockUs += elapsed / clockCyclesPerUs;
+		clockRemainder = elapsed % clockCyclesPerUs;
+	}
+	clockLastCycles = cycles;
+	clockLastMs = ms;
+	return clockUs;
+}
+
+uint32_t pd_hal_ticks_cpu(void) {
+	if (clockCyclesPerUs == 0) {
+		// microseconds, as pd_hal_cpu_hz() says
+		return (uint32_t)pd_hal_ticks_us64();
+	}
+	return DWT_CYCCNT;
+}
+
+uint32_t pd_hal_cpu_hz(void) {
+	return (clockCyclesPerUs == 0) ? 1000000 : clockCyclesPerUs * 1000000;
+}
+
+// DWT_CYCCNT value at which MICROPY_VM_HOOK_POLL yields. If the cycle counter
+// doesn't run, it is always due and pd_hal_vm_yield() falls back to checking
+// the millisecond clock at every MICROPY_VM_HOOK_COUNT branches.
+uint32_t pd_hal_yield_cycles;
+
+void pd_hal_set_yield_deadline(unsigned int ms) {
+	pd_hal_yield_cycles = DWT_CYCCNT + ms * 1000 * clockCyclesPerUs;
+}
+
+void pd_hal_vm_yield(void) {
+	if (clockCyclesPerUs == 0) {
+		static unsigned int divisor = MICROPY_VM_HOOK_COUNT;
+		if (--divisor == 0) {
+			divisor = MICROPY_VM_HOOK_COUNT;
+			pd_hal_wfe_ms(0);
+		}
+	}
+	else {
+		pdco_yield(PDCO_MAIN_ID);
+	}
+}
+
+#elif defined(TARGET_PLAYDATE)
+
+// MICROPY_VM_HOOK_POLL uses updateEndDue
+void pd_hal_set_yield_deadline(unsigned int ms) {
+	(void)ms;
+}
+
+uint64_t pd_hal_ticks_us64(void) {
+	return (uint64_t)(1.0e6f * global_pd->system->getElapsedTime());
+}
+
+void pd_hal_clock_init(void) {
+	pd_hal_clock_start_us = pd_hal_ticks_us64();
+}
+
+uint32_t pd_hal_ticks_cpu(void) {
+	return (uint32_t)pd_hal_ticks_us64();
+}
+
+uint32_t pd_hal_cpu_hz(void) {
+	return 1000000;
+}
+
+#elif defined(TARGET_SIMULATOR) && defined(_WIN32)
+
+static LARGE_INTEGER clockFrequency;
+
+// the simulator's MICROPY_VM_HOOK_POLL uses updateEndDue
+void pd_hal_set_yield_deadline(unsigned int ms) {
+	(void)ms;
+}
+
+static uint64_t pd_hal_ticks_ns64(void) {
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	// split to avoid overflowing 64 bits
+	uint64_t f = clockFrequency.QuadPart;
+	uint64_t c = count.QuadPart;
+	return c / f * 1000000000 + c % f * 1000000000 / f;
+}
+
+uint64_t pd_hal_ticks_us64(void) {
+	return pd_hal_ticks_ns64() / 1000;
+}
+
+void pd_hal_clock_init(void) {
+	QueryPerformanceFrequency(&clockFrequency);
+	pd_hal_clock_start_us = pd_hal_ticks_us64();
+}
+
+uint32_t pd_hal_ticks_cpu(void) {
+	return (uint32_t)pd_hal_ticks_ns64();
+}
+
+uint32_t pd_hal_cpu_hz(void) {
+	return 1000000000;
+}
+
+#elif defined(TARGET_SIMULATOR)
+
+// the simulator's MICROPY_VM_HOOK_POLL uses updateEndDue
+void pd_hal_set_yield_deadline(unsigned int ms) {
+	(void)ms;
+}
+
+static uint64_t pd_hal_ticks_ns64(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t pd_hal_ticks_us64(void) {
+	return pd_hal_ticks_ns64() / 1000;
+}
+
+void pd_hal_clock_init(void) {
+	pd_hal_clock_start_us = pd_hal_ticks_us64();
+}
+
+uint32_t pd_hal_ticks_cpu(void) {
+	return (uint32_t)pd_hal_ticks_ns64();
+}
+
+uint32_t pd_hal_cpu_hz(void) {
+	return 1000000000;
+}
+
+#endif
+
 #if MICROPY_PY_TIME
 
 void mp_hal_delay_ms(mp_uint_t ms) {
@@ -94,7 +321,7 @@ void mp_hal_delay_us(mp_uint_t us) {
 }
 
 mp_uint_t mp_hal_ticks_us(void) {
-	return (mp_uint_t)(1.0e6f * global_pd->system->getElapsedTime());
+	return (mp_uint_t)pd_hal_ticks_us64();
 }
 
 // mp_hal_ticks_cpu #defined in mphalport.h
@@ -113,6 +340,108 @@ uint64_t mp_hal_time_ns(void) {
 
 #endif
 
+// Heap regions, allocated from the C heap. The first one is set up by
+// pd_hal_heap_init(), more are added by the GC when an allocation fails even
+// after a collection, and freed again when they become empty.
+#define PD_HAL_HEAP_MAX_REGIONS 16
+static struct {
+	void *ptr;
+	size_t size;
+} heapRegions[PD_HAL_HEAP_MAX_REGIONS];
+static size_t heapTotal = 0;
+static size_t heapLimit = 0;
+
+void pd_hal_heap_init(size_t size, size_t limit) {
+	heapLimit = (limit > size) ? limit : size;
+	void *heap = pd_hal_alloc_heap(size);
+	if (heap == NULL) {
+		global_pd->system->error("cannot allocate %u bytes of Python heap", (unsigned int)size);
+		return;
+	}
+	gc_init(heap, (char *)heap + size);
+}
+
+void *pd_hal_alloc_heap(size_t size) {
+	if (heapTotal + size > heapLimit) {
+		return NULL;
+	}
+	for (size_t i = 0; i < PD_HAL_HEAP_MAX_REGIONS; i++) {
+		if (heapRegions[i].ptr == NULL) {
+			void *ptr = global_pd->system->realloc(NULL, size);
+			if (ptr != NULL) {
+				heapRegions[i].ptr = ptr;
+				heapRegions[i].size = size;
+				heapTotal += size;
+			}
+			return ptr;
+		}
+	}
+	return NULL;
+}
+
+void pd_hal_free_heap(void *ptr) {
+	for (size_t i = 0; i < PD_HAL_HEAP_MAX_REGIONS; i++) {
+		if (heapRegions[i].ptr == ptr) {
+			global_pd->system->realloc(ptr, 0);
+			heapRegions[i].ptr = NULL;
+			heapTotal -= heapRegions[i].size;
+			return;
+		}
+	}
+}
+
+size_t gc_get_max_new_split(void) {
+	return heapLimit - heapTotal;
+}
+
+void pd_hal_heap_info(size_t *regions, size_t *total, size_t *limit) {
+	*regions = 0;
+	for (size_t i = 0; i < PD_HAL_HEAP_MAX_REGIONS; i++) {
+		if (heapRegions[i].ptr != NULL) {
+			(*regions)++;
+		}
+	}
+	*total = heapTotal;
+	*limit = heapLimit;
+}
+
+#if defined(TARGET_PLAYDATE) && MICROPY_EMIT_MACHINE_CODE
+
+void *pd_hal_commit_exec(void *buf, size_t len, void *reloc) {
+	(void)len;
+	#if MICROPY_PERSISTENT_CODE_LOAD_NATIVE
+	// viper code loaded from a .mpy file, which we are responsible for
+	// relocating when defining MP_PLAT_COMMIT_EXEC
+	if (reloc != NULL) {
+		mp_native_relocate(reloc, buf, (uintptr_t)buf);
+	}
+	#else
+	(void)reloc;
+	#endif
+	// The code was written through the data cache, make sure the instruction
+	// fetches see it and not something stale from the previous use of this
+	// memory.
+	global_pd->system->clearICache();
+	return buf;
+}
+
+#elif defined(TARGET_SIMULATOR) && MICROPY_EMIT_X64
+
+void pd_hal_alloc_exec(size_t min_size, void **ptr, size_t *size) {
+	// round up to whole pages
+	*size = (min_size + 0xfff) & ~(size_t)0xfff;
+	*ptr = mmap(NULL, *size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (*ptr == MAP_FAILED) {
+		*ptr = NULL;
+	}
+}
+
+void pd_hal_free_exec(void *ptr, size_t size) {
+	munmap(ptr, size);
+}
+
+#endif
+
 // Can't output without a trailing '\n', so line-buffer for now
 // (https://devforum.play.date/t/logtoconsole-without-a-linebreak/1819/6)
 static void pdSerialPutchar(char c) {
@@ -191,24 +520,102 @@ uintptr_t mp_hal_stdio_poll(uintptr_t poll_flags) {
 
 #endif
 
+// Idle-time garbage collection: when Python waits with enough time left
+// before update() is due to return, collect garbage now rather than when an
+// allocation fails in the middle of the game logic of a later frame.
+// Collect only if at least this many blocks have been allocated since the last
+// collection...
+#define PD_HAL_IDLE_GC_MIN_BLOCKS 256
+// ...and the last longest pause plus this much fits into the frame.
+#define PD_HAL_IDLE_GC_MARGIN_US 1000
+
+pd_hal_gc_stats_t pd_hal_gc_stats;
+static bool gcIdleRunning = false;
+// expected duration of a collection, decaying maximum of recent idle ones
+static uint32_t gcEstimateUs = 2000;
+
+static void gcRecordPause(uint32_t us) {
+	if (gcIdleRunning) {
+		pd_hal_gc_stats.idle++;
+	}
+	else {
+		pd_hal_gc_stats.other++;
+	}
+	if (us > pd_hal_gc_stats.max_us) {
+		pd_hal_gc_stats.max_us = us;
+	}
+	pd_hal_gc_stats.total_us += us;
+	size_t bucket = 0;
+	for (uint32_t ms = us / 1000; ms > 0 && bucket < PD_HAL_GC_HIST_BUCKETS - 1; ms >>= 1) {
+		bucket++;
+	}
+	pd_hal_gc_stats.hist[bucket]++;
+}
+
+#if defined(TARGET_PLAYDATE)
+
+// Time every collection, see the Makefile.
+void __real_gc_collect(void);
+
+void __wrap_gc_collect(void) {
+	mp_uint_t start = mp_hal_ticks_us();
+	TRACE_BEGIN(eTraceGC);
+	__real_gc_collect();
+	TRACE_END(eTraceGC);
+	gcRecordPause(mp_hal_ticks_us() - start);
+}
+
+#endif
+
+void pd_hal_idle_gc(void) {
+	if (MP_STATE_MEM(gc_alloc_amount) < PD_HAL_IDLE_GC_MIN_BLOCKS || gc_is_locked()) {
+		return;
+	}
+	int left_us = ((int)updateEndDue - (int)global_pd->system->getCurrentTimeMilliseconds()) * 1000;
+	if (left_us < (int)(gcEstimateUs + PD_HAL_IDLE_GC_MARGIN_US)) {
+		return;
+	}
+	mp_uint_t start = mp_hal_ticks_us();
+	gcIdleRunning = true;
+	TRACE_BEGIN(eTraceIdleGC);
+	gc_collect();
+	TRACE_END(eTraceIdleGC);
+	gcIdleRunning = false;
+	uint32_t us = mp_hal_ticks_us() - start;
+	#if !defined(TARGET_PLAYDATE)
+	gcRecordPause(us);
+	#endif
+	gcEstimateUs = (us > gcEstimateUs) ? us : (7 * gcEstimateUs + us) / 8;
+}
+
 void pd_hal_wfe_indefinite(void) {
 	// Wait for event indefinitely, called from mp_event_wait_indefinite():
 	// Just yield and wait for the next update().
+	pd_hal_idle_gc();
 	pdco_yield(PDCO_MAIN_ID);
 }
 
 void pd_hal_wfe_ms(int timeout_ms) {
 	// Wait for event with timeout, called from mp_event_wait_ms() and from
-	// MICROPY_VM_HOOK_POLL: If update() is due to return within the timeout
+	// MICROPY_VM_HOOK_POLL (on the simulator, or on the device if the cycle
+	// counter doesn't run): If update() is due to return within the timeout
 	// (or already in the past), yield and wait for the next call. If not,
 	// yielding would wait for too long, so just busy-wait (there does not seem
 	// to be a sleep function in the Playdate API) or return immediately for
 	// timeout 0 as from MICROPY_VM_HOOK_POLL.
 	int end = global_pd->system->getCurrentTimeMilliseconds() + timeout_ms;
+	if (timeout_ms > 0) {
+		// a real wait, not the middle of some computation
+		pd_hal_idle_gc();
+	}
 	if (end - (int)updateEndDue >= 0) {
 		pdco_yield(PDCO_MAIN_ID);
 	}
 	else if (timeout_ms > 0) {
+		mp_uint_t waitStart = mp_hal_ticks_us();
+		TRACE_BEGIN(eTraceWait);
 		while (end - global_pd->system->getCurrentTimeMilliseconds() > 0) {}
+		TRACE_END(eTraceWait);
+		frameStatsWaitUs += mp_hal_ticks_us() - waitStart;
 	}
 }
@@ -21,6 +21,7 @@ THE SOFTWARE.
 */
 
 #include "preferences.h"
+#include "savestore.h"
 
 #include <string.h>
 
@@ -38,7 +39,11 @@ static void prefsDecodeError(json_decoder* decoder, const char* error, int linen
 static int prefsShouldDecodeTableValueForKey(json_decoder* decoder, const char* key) {
 	// skip anything we're not interested in
 	return strcmp(decoder->path, "_root") == 0
-		&& strcmp(key, "inverted") == 0;
+		&& (strcmp(key, "inverted") == 0
+			|| strcmp(key, "stats") == 0
+			|| strcmp(key, "heapsize") == 0
+			|| strcmp(key, "heaplimit") == 0
+			|| strcmp(key, "stacksize") == 0);
 }
 
 static void prefsDidDecodeTableValue(json_decoder* decoder, const char* key, json_value value) {
@@ -46,6 +51,18 @@ static void prefsDidDecodeTableValue(json_decoder* decoder, const char* key, jso
 	if ((value.type == kJSONTrue || value.type == kJSONFalse) && strcmp(key, "inverted") == 0) {
 		preferences.inverted = json_boolValue(value);
 	}
+	else if ((value.type == kJSONTrue || value.type == kJSONFalse) && strcmp(key, "stats") == 0) {
+		preferences.stats = json_boolValue(value);
+	}
+	else if (value.type == kJSONInteger && strcmp(key, "heapsize") == 0) {
+		preferences.heapsize = json_intValue(value);
+	}
+	else if (value.type == kJSONInteger && strcmp(key, "heaplimit") == 0) {
+		preferences.heaplimit = json_intValue(value);
+	}
+	else if (value.type == kJSONInteger && strcmp(key, "stacksize") == 0) {
+		preferences.stacksize = json_intValue(value);
+	}
 }
 
 static int readfile(void* userdata, uint8_t* buf, int bufsize) {
@@ -62,34 +79,81 @@ void preferencesRead(PlaydateAPI* pd) {
 		.userdata = &ud
 	};
 	preferences.inverted = 0;
+	preferences.stats = 0;
+	preferences.heapsize = PREFERENCES_DEFAULT_HEAPSIZE;
+	preferences.heaplimit = PREFERENCES_DEFAULT_HEAPLIMIT;
+	preferences.stacksize = PREFERENCES_DEFAULT_STACKSIZE;
 	ud.file = pd->file->open("data.json", kFileReadData);
 	if (ud.file != NULL) {
 		pd->json->decode(&decoder, (json_reader){ .read = readfile, .userdata = &ud }, NULL);
 		pd->file->close(ud.file);
 	}
 	// else probably file doesn't exist yet, that's OK
+	if (preferences.heapsize < PREFERENCES_MIN_HEAPSIZE || preferences.heapsize > PREFERENCES_MAX_HEAPSIZE) {
+		preferences.heapsize = PREFERENCES_DEFAULT_HEAPSIZE;
+	}
+	if (preferences.heaplimit < PREFERENCES_MIN_HEAPSIZE || preferences.heaplimit > PREFERENCES_MAX_HEAPSIZE) {
+		preferences.heaplimit = PREFERENCES_DEFAULT_HEAPLIMIT;
+	}
 }
 
-static void writefile(void* userdata, const char* str, int len) {
-	((PrefsUserdata*)userdata)->pd->file->write(((PrefsUserdata*)userdata)->file, str, len);
+typedef struct {
+	PlaydateAPI* pd;
+	char* buf;
+	int len;
+	int size;
+	int error;
+} PrefsBuffer;
+
+static void writebuffer(void* userdata, const char* str, int len) {
+	PrefsBuffer* b = userdata;
+	if (b->error) {
+		return;
+	}
+	if (b->len + len > b->size) {
+		int size = 2*(b->len + len);
+		char* buf = b->pd->system->realloc(b->buf, size);
+		if (buf == NULL) {
+			b->error = 1;
+			return;
+		}
+		b->buf = buf;
+		b->size = size;
+	}
+	memcpy(b->buf + b->len, str, len);
+	b->len += len;
 }
 
+// Encodes into memory and leaves the writing to the save store, so that this
+// can be called from a menu callback without holding up the frame.
 void preferencesWrite(PlaydateAPI* pd) {
-	PrefsUserdata ud;
-	ud.pd = pd;
+	PrefsBuffer b = { pd, NULL, 0, 0, 0 };
 	json_encoder encoder;
-	ud.file = pd->file->open("data.json", kFileWrite);
-	if (ud.file != NULL) {
-		pd->json->initEncoder(&encoder, &writefile, &ud, 0);
-		encoder.startTable(&encoder);
-		encoder.addTableMember(&encoder, "inverted", sizeof("inverted")-1);
-		if (preferences.inverted) {
-			encoder.writeTrue(&encoder);
-		}
-		else {
-			encoder.writeFalse(&encoder);
-		}
-		encoder.endTable(&encoder);
-		pd->file->close(ud.file);
+	pd->json->initEncoder(&encoder, &writebuffer, &b, 0);
+	encoder.startTable(&encoder);
+	encoder.addTableMember(&encoder, "inverted", sizeof("inverted")-1);
+	if (preferences.inverted) {
+		encoder.writeTrue(&encoder);
+	}
+	else {
+		encoder.writeFalse(&encoder);
+	}
+	encoder.addTableMember(&encoder, "stats", sizeof("stats")-1);
+	if (preferences.stats) {
+		encoder.writeTrue(&encoder);
+	}
+	else {
+		encoder.writeFalse(&encoder);
+	}
+	encoder.addTableMember(&encoder, "heapsize", sizeof("heapsize")-1);
+	encoder.writeInt(&encoder, preferences.heapsize);
+	encoder.addTableMember(&encoder, "heaplimit", sizeof("heaplimit")-1);
+	encoder.writeInt(&encoder, preferences.heaplimit);
+	encoder.addTableMember(&encoder, "stacksize", sizeof("stacksize")-1);
+	encoder.writeInt(&encoder, preferences.stacksize);
+	encoder.endTable(&encoder);
+	if (!b.error) {
+		saveStorePut(pd, "data.json", b.buf, b.len);
 	}
+	pd->system->realloc(b.buf, 0);
 }
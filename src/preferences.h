@@ -24,8 +24,26 @@ THE SOFTWARE.
 
 #include "pd_api.h"
 
+// defaults for the MicroPython heap in KiB, see pd_hal_heap_init()
+#define PREFERENCES_DEFAULT_HEAPSIZE 64
+#define PREFERENCES_DEFAULT_HEAPLIMIT 4096
+// values outside this range in data.json are replaced by the defaults, the
+// device has 16 MiB of RAM in total
+#define PREFERENCES_MIN_HEAPSIZE 16
+#define PREFERENCES_MAX_HEAPSIZE 12288
+// default size of the stack of the Python coroutine in KiB
+#define PREFERENCES_DEFAULT_STACKSIZE 64
+
 typedef struct {
 	int inverted;
+	// show the frame statistics overlay on the display card
+	int stats;
+	// initial size of the MicroPython heap and the size up to which it may
+	// grow, in KiB
+	int heapsize;
+	int heaplimit;
+	// size of the stack of the Python coroutine, in KiB
+	int stacksize;
 } Preferences;
 
 extern Preferences preferences;
@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "romfs.h"
+
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "py/objarray.h"
+#include "extmod/vfs.h"
+
+// A memoryview of the image, static because it must outlive soft resets, which
+// throw away the MicroPython heap. The code in modules loaded from it is
+// executed in place rather than copied into the heap.
+static mp_obj_array_t romfsMemoryview = {
+	.base = { &mp_type_memoryview },
+	.typecode = 'B',
+	.free = 0,
+	.len = 0,
+	.items = NULL
+};
+
+void romfsLoad(PlaydateAPI* pd) {
+	FileStat st;
+	if (pd->file->stat(ROMFS_IMAGE, &st) != 0 || st.size == 0) {
+		pd->system->logToConsole("no ROMFS image: %s", pd->file->geterr());
+		return;
+	}
+	SDFile* f = pd->file->open(ROMFS_IMAGE, kFileRead);
+	if (f == NULL) {
+		pd->system->logToConsole("cannot open ROMFS image: %s", pd->file->geterr());
+		return;
+	}
+	uint8_t* buf = pd->system->realloc(NULL, st.size);
+	if (buf == NULL) {
+		pd->system->logToConsole("cannot allocate %u bytes for ROMFS image", (unsigned int)st.size);
+		pd->file->close(f);
+		return;
+	}
+	unsigned int len = 0;
+	while (len < st.size) {
+		int n = pd->file->read(f, buf + len, st.size - len);
+		if (n <= 0) {
+			break;
+		}
+		len += n;
+	}
+	pd->file->close(f);
+	if (len < st.size) {
+		pd->system->logToConsole("cannot read ROMFS image: %s", pd->file->geterr());
+		pd->system->realloc(buf, 0);
+		return;
+	}
+	romfsMemoryview.len = len;
+	romfsMemoryview.items = buf;
+}
+
+// Port hook behind vfs.rom_ioctl(). The image is read-only, only the queries
+// are supported.
+mp_obj_t mp_vfs_rom_ioctl(size_t n_args, const mp_obj_t* args) {
+	if (romfsMemoryview.items == NULL) {
+		return MP_OBJ_NEW_SMALL_INT(-MP_ENODEV);
+	}
+	switch (mp_obj_get_int(args[0])) {
+		case MP_VFS_ROM_IOCTL_GET_NUMBER_OF_SEGMENTS:
+			return MP_OBJ_NEW_SMALL_INT(1);
+		case MP_VFS_ROM_IOCTL_GET_SEGMENT:
+			if (n_args < 2 || mp_obj_get_int(args[1]) != 0) {
+				return MP_OBJ_NEW_SMALL_INT(-MP_EINVAL);
+			}
+			return MP_OBJ_FROM_PTR(&romfsMemoryview);
+		default:
+			return MP_OBJ_NEW_SMALL_INT(-MP_EINVAL);
+	}
+}
@@ -0,0 +1,149 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "savestore.h"
+
+#include <string.h>
+
+
+typedef struct SaveEntry {
+	struct SaveEntry* next;
+	int len;
+	int tries;
+	uint8_t* data;
+	// followed by the path
+	char path[];
+} SaveEntry;
+
+// pending files, oldest first
+static SaveEntry* pending = NULL;
+
+static SaveEntry** saveStoreFind(const char* path) {
+	SaveEntry** p = &pending;
+	while (*p != NULL && strcmp((*p)->path, path) != 0) {
+		p = &(*p)->next;
+	}
+	return p;
+}
+
+static void saveStoreFree(PlaydateAPI* pd, SaveEntry* e) {
+	pd->system->realloc(e->data, 0);
+	pd->system->realloc(e, 0);
+}
+
+int saveStorePut(PlaydateAPI* pd, const char* path, const void* data, int len) {
+	uint8_t* copy = pd->system->realloc(NULL, len > 0 ? len : 1);
+	if (copy == NULL) {
+		return -1;
+	}
+	memcpy(copy, data, len);
+	SaveEntry** p = saveStoreFind(path);
+	SaveEntry* e = *p;
+	if (e != NULL) {
+		// replace what was waiting, keeping its place in the queue
+		pd->system->realloc(e->data, 0);
+	}
+	else {
+		e = pd->system->realloc(NULL, sizeof(SaveEntry) + strlen(path) + 1);
+		if (e == NULL) {
+			pd->system->realloc(copy, 0);
+			return -1;
+		}
+		strcpy(e->path, path);
+		e->next = NULL;
+		*p = e;
+	}
+	e->data = copy;
+	e->len = len;
+	e->tries = 0;
+	return 0;
+}
+
+const void* saveStorePending(const char* path, int* len) {
+	SaveEntry* e = *saveStoreFind(path);
+	if (e == NULL) {
+		return NULL;
+	}
+	*len = e->len;
+	return e->data;
+}
+
+static int saveStoreWrite(PlaydateAPI* pd, SaveEntry* e) {
+	size_t pathlen = strlen(e->path);
+	char* tmp = pd->system->realloc(NULL, pathlen + sizeof(SAVESTORE_TMP_SUFFIX));
+	if (tmp == NULL) {
+		return -1;
+	}
+	memcpy(tmp, e->path, pathlen);
+	memcpy(tmp + pathlen, SAVESTORE_TMP_SUFFIX, sizeof(SAVESTORE_TMP_SUFFIX));
+	// make sure the directory exists, an error if it does is harmless
+	char* slash = strrchr(tmp, '/');
+	if (slash != NULL) {
+		*slash = '\0';
+		pd->file->mkdir(tmp);
+		*slash = '/';
+	}
+	int res = -1;
+	SDFile* f = pd->file->open(tmp, kFileWrite);
+	if (f != NULL) {
+		int ok = (pd->file->write(f, e->data, e->len) == e->len)
+			// flushing appears necessary to avoid "I/O Error" when called from
+			// the Python coroutine by _pew.save_flush()
+			// https://devforum.play.date/t/i-o-error-when-writing-files-from-c-coroutine/24137
+			&& pd->file->flush(f) >= 0;
+		ok = (pd->file->close(f) == 0) && ok;
+		if (ok && pd->file->rename(tmp, e->path) == 0) {
+			res = 0;
+		}
+		else {
+			pd->file->unlink(tmp, 0);
+		}
+	}
+	pd->system->realloc(tmp, 0);
+	return res;
+}
+
+int saveStoreFlushOne(PlaydateAPI* pd) {
+	SaveEntry* e = pending;
+	if (e == NULL) {
+		return 0;
+	}
+	// take it out of the queue first, saveStoreWrite() doesn't call back into
+	// the store, but a failed one goes to the end
+	pending = e->next;
+	e->next = NULL;
+	if (saveStoreWrite(pd, e) == 0) {
+		saveStoreFree(pd, e);
+	}
+	else if (++e->tries >= SAVESTORE_MAX_TRIES) {
+		pd->system->logToConsole("could not write %s: %s", e->path, pd->file->geterr());
+		saveStoreFree(pd, e);
+	}
+	else {
+		*saveStoreFind(e->path) = e;
+	}
+	return pending != NULL;
+}
+
+void saveStoreFlushAll(PlaydateAPI* pd) {
+	while (saveStoreFlushOne(pd)) {}
+}
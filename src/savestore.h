@@ -0,0 +1,48 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include "pd_api.h"
+
+// Write-behind store for files in the data folder (preferences, Python save
+// data): saveStorePut() only keeps a copy in memory, which update() writes
+// out when a frame has time to spare, and everything is written on
+// kEventLock and kEventTerminate. Each file is written to a temporary file
+// first and then renamed over the old one, so an interrupted write leaves the
+// previous contents intact.
+
+// Suffix of the temporary file written next to each file.
+#define SAVESTORE_TMP_SUFFIX ".tmp"
+// Don't start writing in a frame with less than this many milliseconds left.
+#define SAVESTORE_MARGIN_MS 8
+// Give up on a file after this many failed writes.
+#define SAVESTORE_MAX_TRIES 3
+
+// Returns 0, or -1 if out of memory.
+int saveStorePut(PlaydateAPI* pd, const char* path, const void* data, int len);
+// Contents waiting to be written for path (not to be kept across calls into
+// the store), or NULL if there are none.
+const void* saveStorePending(const char* path, int* len);
+// Write the oldest pending file. Returns whether there are more.
+int saveStoreFlushOne(PlaydateAPI* pd);
+void saveStoreFlushAll(PlaydateAPI* pd);
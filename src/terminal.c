@@ -22,6 +22,7 @@ THE SOFTWARE.
 
 #include "terminal.h"
 #include "globals.h"
+#include "input.h"
 
 #include <stdint.h>
 
@@ -256,11 +257,13 @@ void terminalWrite(const char* data, size_t len) {
 	}
 }
 
-void terminalUpdate(PlaydateAPI* pd) {
+int terminalUpdate(PlaydateAPI* pd) {
+	int drew = 0;
 	// Until I can make up my mind about which font looks better: switch fonts
 	// using the A button.
 	PDButtons pushed;
 	pd->system->getButtonState(NULL, &pushed, NULL);
+	inputCollect(pd);
 	if (pushed & kButtonA) {
 		for (int i = 0; i < sizeof(fonts)/sizeof(fonts[0]); i++) {
 			if (font == fonts[i]) {
@@ -285,6 +288,7 @@ void terminalUpdate(PlaydateAPI* pd) {
 			pd->graphics->drawText(&buffer[i*WIDTH_CHARS], WIDTH_CHARS*sizeof(buffer[0]), k16BitLEEncoding, 1, y);
 		}
 		dirtyRowsBegin = dirtyRowsEnd = 0;
+		drew = 1;
 	}
 
 	unsigned int now = pd->system->getCurrentTimeMilliseconds();
@@ -298,5 +302,7 @@ void terminalUpdate(PlaydateAPI* pd) {
 		// else erase it at the old location
 		pd->graphics->fillRect(cursorx, cursory, CELLW, CELLH, kColorXOR);
 		blink = nblink;
+		drew = 1;
 	}
+	return drew;
 }
@@ -30,4 +30,5 @@ void terminalInit(PlaydateAPI* pd);
 void terminalTouch(void);
 void terminalPutchar(unsigned char c);
 void terminalWrite(const char* data, size_t len);
-void terminalUpdate(PlaydateAPI* pd);
+// Returns whether anything was drawn.
+int terminalUpdate(PlaydateAPI* pd);
@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "py/mphal.h"
+#include "py/mpprint.h"
+
+#include "trace.h"
+
+#if PEW_TRACE
+
+typedef struct {
+	uint32_t us;
+	uint8_t event;
+	char phase;
+} TraceRecord;
+
+static const char* const traceNames[eTraceCount] = {
+	"update",
+	"card",
+	"load_async",
+	"python",
+	"wait",
+	"idle gc",
+	"gc",
+	"file open",
+	"file read",
+	"file write",
+	"serial input",
+	"save"
+};
+
+static TraceRecord records[TRACE_EVENTS];
+// total number of events recorded, the ring holds the last TRACE_EVENTS
+static uint32_t recordCount;
+
+void traceRecord(TraceEvent event, char phase) {
+	TraceRecord* r = &records[recordCount++ % TRACE_EVENTS];
+	r->us = mp_hal_ticks_us();
+	r->event = event;
+	r->phase = phase;
+}
+
+int traceDump(const mp_print_t* print) {
+	uint32_t n = (recordCount < TRACE_EVENTS) ? recordCount : TRACE_EVENTS;
+	uint32_t first = recordCount - n;
+	mp_printf(print, "{\"traceEvents\":[\n");
+	for (uint32_t i = 0; i < n; i++) {
+		const TraceRecord* r = &records[(first + i) % TRACE_EVENTS];
+		mp_printf(print, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":1,\"tid\":1%s}%s\n",
+			traceNames[r->event], r->phase, (unsigned int)r->us,
+			(r->phase == 'i') ? ",\"s\":\"g\"" : "", (i + 1 < n) ? "," : "");
+	}
+	mp_printf(print, "],\"displayTimeUnit\":\"ms\"}\n");
+	recordCount = 0;
+	return 0;
+}
+
+#else
+
+int traceDump(const mp_print_t* print) {
+	(void)print;
+	return -1;
+}
+
+#endif
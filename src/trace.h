@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2024 Christian Walther
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Timeline of what the main loop, the Python coroutine, the file system and
+// the garbage collector are doing, for inspecting single stutters in
+// chrome://tracing or https://ui.perfetto.dev after _pew.trace_dump(). Only
+// compiled in with -DPEW_TRACE=1 (see UDEFS in the Makefile), otherwise the
+// TRACE_ macros do nothing.
+#ifndef PEW_TRACE
+#define PEW_TRACE 0
+#endif
+
+// the last this many events are kept
+#define TRACE_EVENTS 4096
+
+typedef enum {
+	eTraceUpdate,
+	eTraceCard,
+	eTraceLoadAsync,
+	// the Python coroutine from being resumed to yielding
+	eTracePython,
+	// busy-waiting in pd_hal_wfe_ms()
+	eTraceWait,
+	eTraceIdleGC,
+	eTraceGC,
+	eTraceFileOpen,
+	eTraceFileRead,
+	eTraceFileWrite,
+	eTraceSerial,
+	// writing out the save store
+	eTraceSave,
+	eTraceCount
+} TraceEvent;
+
+#if PEW_TRACE
+
+void traceRecord(TraceEvent event, char phase);
+
+#define TRACE_BEGIN(event) traceRecord(event, 'B')
+#define TRACE_END(event) traceRecord(event, 'E')
+#define TRACE_INSTANT(event) traceRecord(event, 'i')
+
+#else
+
+#define TRACE_BEGIN(event) ((void)0)
+#define TRACE_END(event) ((void)0)
+#define TRACE_INSTANT(event) ((void)0)
+
+#endif
+
+// Write the recorded events as Chrome trace_event JSON and start over.
+// Returns 0, or -1 if tracing is not compiled in.
+struct _mp_print_t;
+int traceDump(const struct _mp_print_t* print);
@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2024 Christian Walther
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the “Software”), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+# Compress files for transparent decompression by VfsPD: each file given as an
+# argument is written as zlib-compressed "<file>.z" with the window size
+# VfsPD expects (VFS_PD_COMPRESSED_WBITS in src/modules/_pew/vfs_pd.h). Put
+# e.g. game.py.z or game.mpy.z instead of game.py or game.mpy into Files/ and
+# import game as usual, or open('level.bin', 'rb') for level.bin.z.
+
+import sys
+import zlib
+
+WBITS = 10
+
+for path in sys.argv[1:]:
+	with open(path, 'rb') as f:
+		data = f.read()
+	c = zlib.compressobj(level=9, wbits=WBITS)
+	z = c.compress(data) + c.flush()
+	with open(path + '.z', 'wb') as f:
+		f.write(z)
+	print('%s: %d -> %d bytes' % (path, len(data), len(z)))